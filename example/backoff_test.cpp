@@ -0,0 +1,90 @@
+#include <stdio.h>
+
+#include "el.h"
+
+namespace evt_loop {
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what)
+{
+    printf("[backoff_test] %-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok) failures++;
+}
+
+static ReconnectPolicy TestPolicy()
+{
+    ReconnectPolicy policy;
+    policy.base_delay_ms = 100;
+    policy.max_delay_ms = 800;
+    policy.multiplier = 2.0;
+    policy.full_jitter = false;
+    policy.max_attempts = 6;
+    return policy;
+}
+
+/// Doubles up to the cap, gives up after max_attempts, then starts over
+static void TestSequence()
+{
+    static const uint32_t EXPECTED[] = { 100, 200, 400, 800, 800, 800 };
+    ReconnectBackoff backoff(TestPolicy());
+    bool ok = true;
+    uint32_t delay_ms = 0;
+    for (size_t i = 0; i < sizeof(EXPECTED) / sizeof(EXPECTED[0]); i++) {
+        ok &= backoff.NextDelay(delay_ms) && delay_ms == EXPECTED[i];
+    }
+    Check(ok, "delays double up to max_delay_ms");
+    Check(!backoff.NextDelay(delay_ms) && backoff.Stats().give_ups == 1, "gives up after max_attempts");
+    Check(backoff.NextDelay(delay_ms) && delay_ms == 100, "starts over after giving up");
+}
+
+static void TestJitter()
+{
+    ReconnectPolicy policy = TestPolicy();
+    policy.full_jitter = true;
+    policy.max_attempts = 0;
+    ReconnectBackoff backoff(policy);
+    bool ok = true;
+    uint32_t delay_ms = 0;
+    for (uint32_t i = 0; i < 100; i++) {
+        uint32_t cap = std::min(100u << std::min(i, 3u), 800u);
+        ok &= backoff.NextDelay(delay_ms) && delay_ms >= 1 && delay_ms <= cap;
+    }
+    Check(ok, "full jitter stays within [1, cap]");
+}
+
+/// Only a connection lasting stable_ms resets the backoff
+static void TestStability()
+{
+    ReconnectPolicy policy = TestPolicy();
+    policy.stable_ms = 60000;
+    ReconnectBackoff flapping(policy);
+    uint32_t delay_ms = 0;
+    flapping.NextDelay(delay_ms);
+    flapping.NextDelay(delay_ms);
+    flapping.OnConnected();
+    flapping.OnDisconnected();
+    Check(flapping.NextDelay(delay_ms) && delay_ms == 400 && flapping.Stats().reconnects == 1,
+        "a short connection keeps backing off");
+
+    policy.stable_ms = 0;
+    ReconnectBackoff stable(policy);
+    stable.NextDelay(delay_ms);
+    stable.NextDelay(delay_ms);
+    stable.OnConnected();
+    stable.OnDisconnected();
+    Check(stable.NextDelay(delay_ms) && delay_ms == 100, "a stable connection starts over");
+}
+
+}   // ns evt_loop
+
+using namespace evt_loop;
+
+int main(int argc, char **argv) {
+  TestSequence();
+  TestJitter();
+  TestStability();
+
+  printf("[backoff_test] %s\n", failures == 0 ? "passed" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}
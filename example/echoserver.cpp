@@ -16,7 +16,7 @@ class BusinessTester {
       echoserver_binary2_("0.0.0.0", 20000, MessageType::BINARY)
     {
         TcpCallbacksPtr echo_svr_1_cbs = std::shared_ptr<TcpCallbacks>(new TcpCallbacks);
-        echo_svr_1_cbs->on_msg_recvd_cb = std::bind(&BusinessTester::OnMessageRecvd_1, this, std::placeholders::_1, std::placeholders::_2);
+        echo_svr_1_cbs->on_msg_recvd_ptr_cb = std::bind(&BusinessTester::OnMessageRecvd_1, this, std::placeholders::_1, std::placeholders::_2);
 
         TcpCallbacksPtr echo_client_cbs = std::shared_ptr<TcpCallbacks>(new TcpCallbacks);
         echo_client_cbs->on_msg_recvd_cb = std::bind(&BusinessTester::OnMessageRecvd_Client, this, std::placeholders::_1, std::placeholders::_2);
@@ -54,11 +54,11 @@ class BusinessTester {
     }
 
     private:
-    void OnMessageRecvd_1(TcpConnection* conn, const Message* msg)
+    void OnMessageRecvd_1(TcpConnection* conn, MessagePtr& msg)
     {
         printf("[echoserver1] fd: %d, message: %s, length: %lu\n", conn->FD(), msg->Payload(), msg->PayloadSize());
-        //conn->Send(msg->Payload(), msg->PayloadSize());
-        conn->Send(*msg);
+        //conn->Send(*msg);
+        conn->Send(std::move(msg));  // echo the received message itself, no copy
     }
     void OnMessageRecvd_2(TcpConnection* conn, const Message* msg)
     {
@@ -0,0 +1,172 @@
+#include <stdio.h>
+
+#include "el.h"
+#include "framer.h"
+#include "error_code.h"
+
+namespace evt_loop {
+
+/// Frames bytes fed to it as if they were read from a socket
+class FramerTester : public BufferIOEvent {
+    public:
+    FramerTester() : BufferIOEvent(-1), error_(0), closed_(false) { }
+
+    std::vector<string> received_;
+    int                 error_;
+    bool                closed_;
+
+    protected:
+    void OnReceived(const Message* msg) { received_.push_back(msg->Data()); }
+    void OnError(int errcode, const char* errstr) { if (error_ == 0) error_ = errcode; }
+    void OnClosed() { closed_ = true; }
+    void OnEvents(uint32_t events) { }
+};
+
+static int failures = 0;
+
+static void Check(bool ok, const char* format, const char* what)
+{
+    printf("[framer_test] %-4s %s: %s\n", ok ? "ok" : "FAIL", format, what);
+    if (!ok) failures++;
+}
+
+static void Setup(FramerTester& tester, MessageType type, const Framing& framing)
+{
+    if (framing.Valid()) {
+        tester.SetFraming(framing);
+    } else {
+        tester.SetMessageType(type);
+    }
+}
+
+/// Frames arriving one byte at a time come out whole and in order
+static void TestPartial(const char* format, MessageType type, const Framing& framing, const std::vector<string>& frames)
+{
+    FramerTester tester;
+    Setup(tester, type, framing);
+    string stream;
+    for (size_t i = 0; i < frames.size(); i++) {
+        stream += frames[i];
+    }
+    for (size_t i = 0; i < stream.size(); i++) {
+        tester.FeedRxBuffer(&stream[i], 1);
+    }
+    Check(tester.received_ == frames && !tester.closed_, format, "partial input");
+}
+
+/// A frame above the size limit closes the connection, those before it are delivered
+static void TestOversize(const char* format, MessageType type, const Framing& framing, const string& small, const string& large)
+{
+    FramerTester tester;
+    Setup(tester, type, framing);
+    tester.SetMaxMessageSize(large.size() - 1);
+    string stream = small + large;
+    bool open = tester.FeedRxBuffer(stream.data(), stream.size());
+    Check(!open && tester.closed_ && tester.error_ == ERR_CODE_MSG_TOO_LARGE &&
+        tester.received_.size() == 1 && tester.received_[0] == small, format, "oversize input");
+}
+
+static string Frame(MessageType type, const Framing& framing, const string& payload)
+{
+    if (type == MessageType::CRLF) {
+        return payload + "\r\n";     // sent as it is
+    }
+    MessagePtr msg = framing.Valid() ? CreateMessage(framing, payload.data(), payload.size()) :
+        CreateMessage(type, payload.data(), payload.size());
+    return msg->Data();
+}
+
+static void TestFormat(const char* format, MessageType type, const Framing& framing = Framing())
+{
+    std::vector<string> frames;
+    frames.push_back(Frame(type, framing, "hello"));
+    frames.push_back(Frame(type, framing, string(300, 'x')));
+    frames.push_back(Frame(type, framing, "world"));
+    TestPartial(format, type, framing, frames);
+    TestOversize(format, type, framing, frames[0], frames[1]);
+}
+
+static void TestJson()
+{
+    std::vector<string> frames;
+    frames.push_back("{\"a\":\"}\"}");
+    frames.push_back("[1,{\"b\":\"\\\"]\"},[2]]");
+    frames.push_back("\"top } level\"");
+    TestPartial("JSON", MessageType::JSON, Framing(), frames);
+    TestOversize("JSON", MessageType::JSON, Framing(), frames[0], "{\"c\":\"" + string(300, 'y') + "\"}");
+
+    std::vector<string> lines;
+    lines.push_back("{\"a\":1}\n");
+    lines.push_back("[2,3]\n");
+    TestPartial("NDJSON", MessageType::NDJSON, Framing(), lines);
+    TestOversize("NDJSON", MessageType::NDJSON, Framing(), lines[0], "{\"b\":\"" + string(300, 'z') + "\"}\n");
+}
+
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+static string BinaryFrame(const string& payload, uint8_t flags, bool good_checksum = true)
+{
+    BinaryMessage::HDR hdr;
+    hdr.length = sizeof(hdr) + payload.size();
+    hdr.flags = flags;
+    if (flags & BinaryMessage::FLAG_CHECKSUM) {
+        hdr.checksum = Crc32c(payload.data(), payload.size()) ^ (good_checksum ? 0 : 1);
+    }
+    return string((const char*)&hdr, sizeof(hdr)) + payload;
+}
+
+/// A corrupted message closes the connection, the one before it is delivered
+static void TestChecksum()
+{
+    FramerTester tester;
+    tester.SetMessageType(MessageType::BINARY);
+    string good = BinaryFrame("intact", BinaryMessage::FLAG_CHECKSUM);
+    string stream = good + BinaryFrame("tampered", BinaryMessage::FLAG_CHECKSUM, false) + good;
+    bool open = tester.FeedRxBuffer(stream.data(), stream.size());
+    Check(!open && tester.closed_ && tester.error_ == ERR_CODE_MSG_CORRUPT && tester.received_.size() == 1,
+        "BINARY", "checksum mismatch");
+}
+
+static void TestReassembly()
+{
+    const uint8_t more = BinaryMessage::FLAG_FRAGMENT | BinaryMessage::FLAG_MORE_FRAGMENTS;
+    string stream = BinaryFrame("frag", more | BinaryMessage::FLAG_CHECKSUM) + BinaryFrame("ment", more) +
+        BinaryFrame("ed", BinaryMessage::FLAG_FRAGMENT);
+    FramerTester tester;
+    tester.SetMessageType(MessageType::BINARY);
+    for (size_t i = 0; i < stream.size(); i++) {
+        tester.FeedRxBuffer(&stream[i], 1);
+    }
+    bool whole = (tester.received_.size() == 1 &&
+        tester.received_[0].substr(sizeof(BinaryMessage::HDR)) == "fragmented");
+    Check(whole && !tester.closed_, "BINARY", "fragment reassembly");
+
+    FramerTester limited;
+    limited.SetMessageType(MessageType::BINARY);
+    limited.SetMaxMessageSize(sizeof(BinaryMessage::HDR) + 8);
+    bool open = limited.FeedRxBuffer(stream.data(), stream.size());
+    Check(!open && limited.closed_ && limited.error_ == ERR_CODE_MSG_TOO_LARGE && limited.received_.empty(),
+        "BINARY", "oversize reassembly");
+}
+#endif
+
+}   // ns evt_loop
+
+using namespace evt_loop;
+
+int main(int argc, char **argv) {
+  Logger::SetLevel(EL_LOG_LEVEL_ERROR);
+
+  TestFormat("CRLF", MessageType::CRLF);
+  TestFormat("BINARY", MessageType::BINARY);
+  TestFormat("TLV", MessageType::TLV);
+  TestFormat("VARINT", MessageType::CUSTOM, MakeFraming<VarintLengthFramer>());
+  TestFormat("UINT32", MessageType::CUSTOM, MakeFraming<Uint32LengthFramer>());
+  TestJson();
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+  TestChecksum();
+  TestReassembly();
+#endif
+
+  printf("[framer_test] %s\n", failures == 0 ? "passed" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "el.h"
+
+namespace evt_loop {
+
+/// One end of a socket pair in the loop, the test holds the other end
+class Endpoint : public BufferIOEvent {
+    public:
+    Endpoint() : BufferIOEvent(-1) {
+        int fds[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        peer_fd_ = fds[1];
+        SetMessageType(MessageType::BINARY);
+        SetFD(fds[0]);  // joins the loop
+    }
+    ~Endpoint() {
+        int fd = FD();
+        SetFD(-1);
+        close(fd);
+        close(peer_fd_);
+    }
+
+    /// Reads what the endpoint has written so far on the far side
+    void DrainPeer() {
+        char buffer[65536];
+        for (int i = 0; i < 1000 && !TxBuffEmpty(); i++) {
+            while (read(peer_fd_, buffer, sizeof(buffer)) > 0) { }
+            EV_Singleton->ProcessEvents(1);
+        }
+    }
+
+    private:
+    int peer_fd_;
+};
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what)
+{
+    printf("[watermark_test] %-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok) failures++;
+}
+
+/// A source shared by two slow consumers is read again only once both have drained
+static void TestTwoDownstreams()
+{
+    const size_t high = 64 * 1024, low = 16 * 1024;
+    Endpoint source, first, second;
+    first.SetWriteWatermarks(high, low);
+    second.SetWriteWatermarks(high, low);
+    first.SetUpstream(&source);
+    second.SetUpstream(&source);
+
+    string bulk(1024 * 1024, 'x');
+    first.Send(bulk);
+    Check(first.AboveHighWatermark() && source.ReadPaused(), "first above high pauses the source");
+    second.Send(bulk);
+    Check(second.AboveHighWatermark() && source.ReadPaused(), "second above high keeps it paused");
+
+    first.DrainPeer();
+    Check(!first.AboveHighWatermark() && source.ReadPaused(), "first drained, second still holds it");
+    second.DrainPeer();
+    Check(!second.AboveHighWatermark() && !source.ReadPaused(), "both drained resumes the source");
+
+    first.Send(bulk);
+    first.SetUpstream(NULL);
+    Check(!source.ReadPaused(), "unlinking a downstream above high releases its pause");
+    second.Send(bulk);
+    second.SetUpstream(NULL);
+    Check(!source.ReadPaused(), "so does the other one");
+}
+
+}   // ns evt_loop
+
+using namespace evt_loop;
+
+int main(int argc, char **argv) {
+  Logger::SetLevel(EL_LOG_LEVEL_ERROR);
+
+  TestTwoDownstreams();
+
+  printf("[watermark_test] %s\n", failures == 0 ? "passed" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+#ifndef _COMPRESSOR_H
+#define _COMPRESSOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <memory>
+
+namespace evt_loop {
+
+/// Codecs are compiled in with ENABLE_LZ4=1 / ENABLE_ZSTD=1 (see src/Makefile)
+enum CompressionType {
+  COMPRESS_NONE,
+  COMPRESS_LZ4,
+  COMPRESS_ZSTD,
+};
+
+/// A raw dictionary both ends of a connection agree on, digested once for
+/// every codec so that using it costs nothing per message
+class CompressionDict {
+  friend class Compressor;
+ public:
+  CompressionDict(const std::string& content, int zstd_level = 3);
+  ~CompressionDict();
+  const std::string& Content() const { return content_; }
+
+ private:
+  CompressionDict(const CompressionDict&);
+  CompressionDict& operator=(const CompressionDict&);
+
+ private:
+  std::string content_;
+  void*       zstd_cdict_;
+  void*       zstd_ddict_;
+};
+typedef std::shared_ptr<CompressionDict> CompressionDictPtr;
+
+struct CompressionOptions {
+  CompressionOptions() : type(COMPRESS_NONE), level(0), threshold(1024) { }
+
+  CompressionType     type;
+  int                 level;      // codec specific, 0 is the codec default
+  size_t              threshold;  // smaller payloads are sent as they are
+  CompressionDictPtr  dict;
+};
+
+/// Compression contexts and scratch state of the thread's event loop, shared
+/// by all of its connections. A compressed block is the uint32 size of the
+/// original data followed by the codec's output.
+class Compressor {
+ public:
+  static Compressor& Instance();
+  static bool Supported(CompressionType type);
+
+  /// Replaces out with the compressed block, fails when the codec is not
+  /// available or the data did not shrink
+  bool Compress(const CompressionOptions& opts, const char* data, size_t size, std::string& out);
+  /// Replaces out with the original data, which must not exceed max_size
+  /// (0 means 64 MiB) so that a crafted block can not exhaust memory. An LZ4
+  /// block is also bounded by the most its format can expand.
+  bool Decompress(CompressionType type, const CompressionDict* dict,
+      const char* data, size_t size, size_t max_size, std::string& out);
+
+ private:
+  Compressor();
+  ~Compressor();
+
+ private:
+  void*       zstd_cctx_;
+  void*       zstd_dctx_;
+  void*       lz4_state_;
+};
+
+}  // namespace evt_loop
+
+#endif  // _COMPRESSOR_H
@@ -4,6 +4,7 @@
 #include "eventloop.h"
 #include "tcp_connection.h"
 #include "timer_handler.h"
+#include "logger.h"
 
 namespace evt_loop {
 
@@ -31,7 +32,7 @@ class ConnectionManager
     void CloseInactivityConnection();
     void OnConnectionInactivityCb(PeriodicTimer* timer)
     {
-        printf("Connection inactivity checking on timer, now: %lu.\n", Now());
+        EL_LOG_DEBUG("Connection inactivity checking on timer, now: %lu.", Now());
         CloseInactivityConnection();
     }
 
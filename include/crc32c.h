@@ -0,0 +1,16 @@
+#ifndef _CRC32C_H
+#define _CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace evt_loop {
+
+/// CRC32C (Castagnoli) of data, continuing from the crc of the bytes before
+/// it, so Crc32c(b, Crc32c(a)) == Crc32c(a + b). Uses the SSE4.2 crc32
+/// instruction when the CPU has it and a lookup table otherwise.
+uint32_t Crc32c(const char* data, size_t size, uint32_t crc = 0);
+
+}  // namespace evt_loop
+
+#endif  // _CRC32C_H
@@ -2,8 +2,13 @@
 #define _EL_H
 
 #include "eventloop.h"
+#include "logger.h"
 #include "tcp_client.h"
 #include "tcp_server.h"
+#include "tcp_relay.h"
+#include "udp_socket.h"
+#include "handover.h"
+#include "framer.h"
 #include "timer_handler.h"
 #include "signal_handler.h"
 #include "session_mngr.h"
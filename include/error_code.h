@@ -4,6 +4,8 @@
 namespace evt_loop {
 
 const int ERR_CODE_CONN_BUFFER_FULL = 30000;
+const int ERR_CODE_MSG_TOO_LARGE = 30001;
+const int ERR_CODE_MSG_CORRUPT = 30002;
 const int ERR_CODE_SERVERITY = 50000;
 
 }  // ns evt_loop
@@ -2,8 +2,12 @@
 #define _FD_HANDLER_H
 
 #include <string>
+#include <vector>
+#include <sys/uio.h>
 #include "event.h"
 #include "message.h"
+#include "compressor.h"
+#include "tx_scheduler.h"
 
 using std::string;
 
@@ -18,6 +22,9 @@ class IOEvent : public IEvent {
   static const uint32_t  ERROR = 1 << 2;
   static const uint32_t  CREATE = 1 << 3;
   static const uint32_t  CLOSED = 1 << 4;
+  /// Not an event: the fd was created non-blocking (e.g. by accept4), so
+  /// registering it skips the fcntl() calls
+  static const uint32_t  NONBLOCK = 1 << 5;
 
  public:
   IOEvent(int fd = -1, uint32_t events = IOEvent::READ | IOEvent::ERROR);
@@ -49,39 +56,170 @@ class IOEvent : public IEvent {
 class BufferIOEvent : public IOEvent {
  public:
   BufferIOEvent(int fd, uint32_t events = IOEvent::READ | IOEvent::ERROR)
-    : IOEvent(fd, events), sent_(0), msg_seq_(0) {
+    : IOEvent(fd, events), sent_(0), msg_seq_(0), max_msg_size_(0), stream_threshold_(0), stream_offset_(0), stream_crc_(0),
+      tx_high_watermark_(0), tx_low_watermark_(0), tx_above_high_(false), upstream_(NULL), paused_by_(0),
+      rx_dispatcher_(std::bind(&BufferIOEvent::CollectMessage, this, std::placeholders::_1)),
+      rx_error_(0), rx_error_str_(NULL) {
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+    checksum_ = false;
+    rx_frag_discard_ = false;
+#endif
   }
+  virtual ~BufferIOEvent();
 
  public:
   void SetMessageType(const MessageType& msg_type) {
     msg_type_ = msg_type;
+    framing_ = Framing();
     rx_msg_mq_.Clear();
     rx_msg_mq_.SetMessageType(msg_type_);
-    tx_msg_mq_.Clear();
-    tx_msg_mq_.SetMessageType(msg_type_);
+    tx_sched_.Clear();
   }
+  /// Switches to a user wire format, e.g. SetFraming(MakeFraming<VarintLengthFramer>())
+  void SetFraming(const Framing& framing) {
+    msg_type_ = MessageType::CUSTOM;
+    framing_ = framing;
+    rx_msg_mq_.Clear();
+    rx_msg_mq_.SetFraming(framing_);
+    tx_sched_.Clear();
+  }
+  /// Frames announcing more than max_msg_size bytes (or unframed messages
+  /// growing beyond it) close the connection, 0 means unlimited
+  void SetMaxMessageSize(size_t max_msg_size) { max_msg_size_ = max_msg_size; UpdateSizeLimit(); }
+  /// Payloads of frames larger than the threshold are not buffered but handed
+  /// to OnReceivedChunk() piece by piece as they arrive, 0 disables streaming.
+  /// Applies to formats with a length header (BINARY, TLV, CUSTOM). A
+  /// checksummed binary frame is verified before its last chunk, on a
+  /// mismatch that chunk is withheld and the connection is closed.
+  /// Fragments and compressed payloads can only be used whole, such a frame
+  /// above the threshold closes the connection with ERR_CODE_MSG_TOO_LARGE.
+  void SetStreamThreshold(size_t threshold) { stream_threshold_ = threshold; UpdateSizeLimit(); }
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+  /// Binary messages sent from now on carry the CRC32C of their payload.
+  /// Received messages are verified whenever the sender set FLAG_CHECKSUM,
+  /// a mismatch closes the connection with ERR_CODE_MSG_CORRUPT.
+  /// Messages sent by SendShared() are left as they are, stamp them with
+  /// BinaryMessage::SetChecksum() before sharing them.
+  void SetChecksum(bool enable) { checksum_ = enable; }
+  /// Binary payloads of at least opts.threshold bytes are compressed when it
+  /// makes them smaller, received compressed payloads are always restored
+  /// before they are dispatched, so handlers only see plaintext. Both ends
+  /// must use the same dictionary. Messages sent by SendShared() and frames
+  /// delivered in chunks (SetStreamThreshold) are passed through as they are.
+  bool SetCompression(const CompressionOptions& opts) {
+    if (opts.type != COMPRESS_NONE && !Compressor::Supported(opts.type)) return false;
+    compression_ = opts;
+    return true;
+  }
+  /// Binary messages with more payload than this are sent in fragments so
+  /// that more urgent lanes get in between, 0 (default) disables it
+  void SetFragmentSize(size_t size) { tx_sched_.SetFragmentSize(size); }
+#endif
+  /// Share of the output each lane gets while several lanes are backlogged
+  void SetLaneWeight(TxLane lane, uint32_t weight) { tx_sched_.SetWeight(lane, weight); }
+  /// OnHighWatermark() is raised once more than high bytes wait to be sent,
+  /// OnLowWatermark() once they have drained to low again. 0 disables both.
+  void SetWriteWatermarks(size_t high, size_t low);
+  /// Reading on upstream is paused while this connection is above its high
+  /// watermark, so a fast producer can not outrun a slow consumer. An
+  /// upstream shared by several connections resumes once none of them is
+  /// above its high watermark. SetUpstream(NULL) and destroying this
+  /// connection release its pause. An upstream destroyed first unlinks itself.
+  void SetUpstream(BufferIOEvent* upstream);
+  bool ReadPaused() const { return paused_by_ > 0; }
+  size_t TxQueuedBytes() const { return tx_sched_.QueuedBytes() - sent_; }
+  bool AboveHighWatermark() const { return tx_above_high_; }
   void ClearBuff();
   bool TxBuffEmpty();
+  size_t TakeRxBuffer(string& data);
+  /// Frames bytes read elsewhere as if they came from the socket, the
+  /// counterpart of TakeRxBuffer(). false when the connection was closed.
+  bool FeedRxBuffer(const char* data, size_t size) { return size == 0 || ConsumeData(data, size); }
+  /// Nothing waits to be sent and no message is streamed or reassembled, the
+  /// receive state is then all in TakeRxBuffer()
+  bool IsIdle() const;
   void Send(const Message& msg);
+  void Send(MessagePtr&& msg);
+  /// Queues a reference to a message shared with other connections, the
+  /// message must not be modified afterwards
+  void SendShared(const MessagePtr& msg, TxLane lane = TX_LANE_NORMAL);
+  /// Like Send(), on an outbound lane other than TX_LANE_NORMAL
+  void SendOnLane(TxLane lane, MessagePtr&& msg);
+  void SendOnLane(TxLane lane, const char *data, uint32_t len, bool bmsg_has_hdr = BinaryMessage::HAS_NO_HDR);
   void Send(const string& data, bool bmsg_has_hdr = BinaryMessage::HAS_NO_HDR);
   void Send(const char *data, uint32_t len, bool bmsg_has_hdr = BinaryMessage::HAS_NO_HDR);
+  /// Sends the fragments as one message, framed as Send() frames the data:
+  /// BINARY, TLV (tagged DEFAULT_TAG) and custom framing get a header, CRLF
+  /// and JSON go as they are. NDJSON and compressed binary payloads are
+  /// gathered into one buffer first. With an empty output buffer the frame
+  /// is written straight from the fragments by writev(). If the socket does
+  /// not take all of it, the whole frame is copied into the output buffer
+  /// and sending resumes after the bytes already written. Frames sent this
+  /// way never raise OnSent, whether written at once or queued; a gathered
+  /// one goes as Send() and does.
+  void Send(const struct iovec* iov, int iovcnt);
 
  protected:
   virtual void OnReceived(const Message* msg) { };
+  virtual void OnReceivedMessage(MessagePtr& msg) { OnReceived(msg.get()); }
+  virtual void OnReceivedChunk(const MessageChunk& chunk) { };
+  /// All messages completed by one read, in order. Handlers may move them out.
+  virtual void OnReceivedBatch(std::vector<MessagePtr>& msgs);
   virtual void OnSent(const Message* msg) { };
+  virtual void OnHighWatermark(size_t queued) { };
+  virtual void OnLowWatermark(size_t queued) { };
+  virtual void OnEvents(uint32_t events);
+  /// Bytes written straight to the socket would cut into a relayed stream
+  virtual bool Relayed() const { return false; }
 
  private:
-  void OnEvents(uint32_t events);
   int ReceiveData();
+  bool ConsumeData(const char* data, size_t size);
+  bool StreamData(const char* data, size_t size, size_t& taken);
+  void UpdateSizeLimit();
   int SendData();
-  void SendInner(const MessagePtr& msg);
+  void SendInner(const MessagePtr& msg, TxLane lane = TX_LANE_NORMAL, bool report = true);
+  void CheckWatermarks();
+  void Pause();
+  void Unpause();
+  void CollectMessage(MessagePtr& msg);
+  void FailMessage(int errcode, const char* errstr);
+  void FlushBatch();
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+  void StampHeader(MessagePtr& msg);
+  MessagePtr Compress(const BinaryMessage* bmsg);
+  MessagePtr Decompress(const BinaryMessage* bmsg);
+  MessagePtr Reassemble(MessagePtr& frag);
+#endif
 
  private:
   MessageType   msg_type_;
+  Framing       framing_;
   MessageMQ     rx_msg_mq_;
-  MessageMQ     tx_msg_mq_;
+  TxScheduler   tx_sched_;
   uint32_t      sent_;
   uint32_t      msg_seq_;
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+  bool          checksum_;
+  CompressionOptions compression_;
+  MessagePtr    rx_fragments_;      // the fragmented message being reassembled
+  bool          rx_frag_discard_;   // the rest of an oversized fragmented message is dropped
+#endif
+  size_t        max_msg_size_;
+  size_t        stream_threshold_;
+  MessagePtr    stream_msg_;        // the frame being streamed, header only
+  size_t        stream_offset_;     // payload bytes delivered so far
+  uint32_t      stream_crc_;        // CRC32C of those bytes
+  size_t        tx_high_watermark_;
+  size_t        tx_low_watermark_;
+  bool          tx_above_high_;
+  BufferIOEvent* upstream_;         // its reading is paused while we are above the high watermark
+  std::vector<BufferIOEvent*> downstreams_;   // those having this one as their upstream
+  size_t        paused_by_;         // downstreams above their high watermark
+  MessageMQ::MessageDispatcher rx_dispatcher_;
+  std::vector<MessagePtr> rx_batch_;  // reused from read to read
+  int           rx_error_;          // a message of this read failed, the connection is closed
+  const char*   rx_error_str_;
 
 };
 
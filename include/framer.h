@@ -0,0 +1,209 @@
+#ifndef _FRAMER_H
+#define _FRAMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include "message.h"
+
+namespace evt_loop {
+
+/// Results of Framer::ParseHeader(). A framer whose headers can not be
+/// malformed may return a bool instead, false and true mean INCOMPLETE and OK.
+enum FrameHeaderStatus {
+  FRAME_HEADER_MALFORMED = -1,  // the stream is corrupt, no frame boundary can be found again
+  FRAME_HEADER_INCOMPLETE = 0,
+  FRAME_HEADER_OK = 1,
+};
+
+/// A header announcing a larger payload is taken as malformed, as large as
+/// the 32 bit lengths of the built-in message types go
+#define MAX_FRAME_PAYLOAD_SIZE  ((size_t)UINT32_MAX)
+
+/// A Framer describes a length-prefixed wire format with static members:
+///
+///   struct MyFramer {
+///     enum { MAX_HEADER_SIZE = 8 };   // at most MAX_FRAME_HEADER_SIZE
+///     /// Decodes the header at the front of data into the header size and
+///     /// the payload size, returns a FrameHeaderStatus
+///     static int ParseHeader(const char* data, size_t size, size_t& header_size, size_t& payload_size);
+///     /// Encodes the header of a payload into out, returns its size
+///     static size_t WriteHeader(char* out, size_t payload_size);
+///   };
+///
+/// FramedMessage<MyFramer> calls them directly, so the parse loop of a custom
+/// protocol is inlined instead of going through one more layer of virtuals.
+/// A connection picks the format up with SetFraming(MakeFraming<MyFramer>()).
+template <typename Framer>
+class FramedMessage : public Message {
+  public:
+  FramedMessage() : Message(MessageType::CUSTOM), header_size_(0), frame_size_(0), malformed_(false) { }
+  FramedMessage(const FramedMessage& other) : Message(MessageType::CUSTOM) {
+    *this = other;
+  }
+  FramedMessage& operator=(const FramedMessage& rvalue) {
+    data_ = rvalue.data_;
+    header_size_ = rvalue.header_size_;
+    frame_size_ = rvalue.frame_size_;
+    malformed_ = rvalue.malformed_;
+    return *this;
+  }
+
+  size_t MoreSize() const {
+    if (frame_size_ == 0) return Framer::MAX_HEADER_SIZE - data_.size();
+    return frame_size_ - data_.size();
+  }
+  bool Completion() const { return frame_size_ != 0 && data_.size() == frame_size_; }
+
+  /// Consumes the header first and then bytes up to the end of the frame only.
+  /// Nothing is taken any more once the header is found malformed.
+  size_t AppendData(const char* data, uint32_t length) {
+    if (data == NULL || length == 0 || Completion() || malformed_)
+      return 0;
+    if (frame_size_ == 0) {
+      /// Buffer just enough bytes to decode the header, the surplus is given
+      /// back once the frame turns out to be shorter than that
+      size_t feeds = std::min(Framer::MAX_HEADER_SIZE - data_.size(), (size_t)length);
+      data_.append(data, feeds);
+      size_t payload_size = 0;
+      int status = Framer::ParseHeader(data_.data(), data_.size(), header_size_, payload_size);
+      if (status == FRAME_HEADER_INCOMPLETE) {
+        return feeds;
+      }
+      /// Bounding the payload also keeps the frame size from wrapping around
+      if (status != FRAME_HEADER_OK || header_size_ == 0 || header_size_ > data_.size()
+          || payload_size > MAX_FRAME_PAYLOAD_SIZE) {
+        malformed_ = true;
+        header_size_ = 0;
+        return feeds;
+      }
+      frame_size_ = header_size_ + payload_size;
+      if (data_.size() > frame_size_) {
+        feeds -= data_.size() - frame_size_;
+        data_.resize(frame_size_);
+      } else {
+        data_.reserve(std::min(frame_size_, (size_t)MAX_UPFRONT_RESERVE));
+      }
+      return feeds;
+    }
+    size_t feeds = std::min(frame_size_ - data_.size(), (size_t)length);
+    data_.append(data, feeds);
+    return feeds;
+  }
+  /// Without has_hdr the data is the payload and the header is prepended
+  size_t AssignData(const char* data, uint32_t length, bool has_hdr = false) {
+    Clear();
+    if (has_hdr) {
+      return AppendData(data, length);
+    }
+    char hdr[MAX_FRAME_HEADER_SIZE];
+    header_size_ = Framer::WriteHeader(hdr, length);
+    frame_size_ = header_size_ + length;
+    data_.reserve(frame_size_);
+    data_.append(hdr, header_size_);
+    data_.append(data, length);
+    return length;
+  }
+
+  const char* Payload() const     { return data_.data() + header_size_; }
+  size_t PayloadSize() const      { return Completion() && frame_size_ > header_size_ ? frame_size_ - header_size_ : 0; }
+  void Clear()                    { Message::Clear(); header_size_ = frame_size_ = 0; malformed_ = false; }
+  bool Malformed() const          { return malformed_; }
+  size_t ExpectedSize() const     { return frame_size_; }
+  size_t HeaderSize() const       { return header_size_; }
+
+  MessagePtr Clone() const {
+    std::shared_ptr<FramedMessage> msg_ptr = ObjectPool<FramedMessage>::Instance().Acquire();
+    *msg_ptr = *this;
+    return msg_ptr;
+  }
+  static MessagePtr Create() { return ObjectPool<FramedMessage>::Instance().Acquire(); }
+
+  private:
+  size_t  header_size_;
+  size_t  frame_size_;    // 0 until the header is decoded
+  bool    malformed_;
+};
+
+template <typename Framer>
+Framing MakeFraming() {
+  static_assert(Framer::MAX_HEADER_SIZE <= MAX_FRAME_HEADER_SIZE, "frame header is too large");
+  Framing framing;
+  framing.create = &FramedMessage<Framer>::Create;
+  framing.write_header = &Framer::WriteHeader;
+  return framing;
+}
+
+/// Payload size as an unsigned LEB128 varint (protobuf style delimiting).
+/// A varint running past 64 bits is malformed.
+struct VarintLengthFramer {
+  enum { MAX_HEADER_SIZE = 10 };
+
+  static int ParseHeader(const char* data, size_t size, size_t& header_size, size_t& payload_size) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size && i < MAX_HEADER_SIZE; i++) {
+      uint8_t byte = (uint8_t)data[i];
+      if (i == MAX_HEADER_SIZE - 1 && byte > 1) {
+        return FRAME_HEADER_MALFORMED;  // the tenth byte holds bit 63 only
+      }
+      value |= (uint64_t)(byte & 0x7f) << (7 * i);
+      if ((byte & 0x80) == 0) {
+        header_size = i + 1;
+        payload_size = value;
+        return FRAME_HEADER_OK;
+      }
+    }
+    return FRAME_HEADER_INCOMPLETE;
+  }
+  static size_t WriteHeader(char* out, size_t payload_size) {
+    size_t n = 0;
+    uint64_t value = payload_size;
+    while (value >= 0x80) {
+      out[n++] = (char)((value & 0x7f) | 0x80);
+      value >>= 7;
+    }
+    out[n++] = (char)value;
+    return n;
+  }
+};
+
+/// A fixed HeaderSize byte header holding a LengthBytes wide big-endian
+/// length at LengthOffset. With LengthIncludesHeader the length counts the
+/// header too. Other header bytes are left zero on send.
+template <size_t HeaderSize, size_t LengthOffset = 0, size_t LengthBytes = 4, bool LengthIncludesHeader = false>
+struct BigEndianLengthFramer {
+  enum { MAX_HEADER_SIZE = HeaderSize };
+  static_assert(LengthBytes >= 1 && LengthBytes <= 8 && LengthOffset + LengthBytes <= HeaderSize,
+      "the length field must lie inside the header");
+
+  static int ParseHeader(const char* data, size_t size, size_t& header_size, size_t& payload_size) {
+    if (size < HeaderSize) return FRAME_HEADER_INCOMPLETE;
+    uint64_t value = 0;
+    for (size_t i = 0; i < LengthBytes; i++) {
+      value = (value << 8) | (uint8_t)data[LengthOffset + i];
+    }
+    if (LengthIncludesHeader) {
+      value = value < HeaderSize ? 0 : value - HeaderSize;
+    }
+    header_size = HeaderSize;
+    payload_size = value;
+    return FRAME_HEADER_OK;
+  }
+  static size_t WriteHeader(char* out, size_t payload_size) {
+    uint64_t value = payload_size + (LengthIncludesHeader ? HeaderSize : 0);
+    memset(out, 0, HeaderSize);
+    for (size_t i = LengthBytes; i > 0; i--) {
+      out[LengthOffset + i - 1] = (char)(value & 0xff);
+      value >>= 8;
+    }
+    return HeaderSize;
+  }
+};
+
+/// The common 4 byte network order length prefix
+typedef BigEndianLengthFramer<4> Uint32LengthFramer;
+
+}  // namespace evt_loop
+
+#endif  // _FRAMER_H
@@ -0,0 +1,95 @@
+#ifndef _HANDOVER_H
+#define _HANDOVER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "tcp_server.h"
+
+using std::string;
+
+namespace evt_loop {
+
+/// A socket passed from the old process to the new one
+struct HandoverSocket
+{
+    enum Kind { LISTENER = 1, CONNECTION = 2 };
+
+    uint32_t    kind;
+    string      name;       // of the server it belongs to, to match it up again
+    int         fd;
+    string      pending;    // received bytes of an incomplete message (CONNECTION)
+};
+
+/// Zero-downtime restart, the old process' side. It listens on a unix socket
+/// path ("@name" for the abstract namespace). When the new process connects,
+/// it sends the listening socket of every server added, then their idle
+/// connections where asked to. Once the new process has confirmed, the
+/// servers stop accepting. The kernel accept queue is shared, so no client
+/// is refused meanwhile. The callback then tells the application to drain
+/// the connections left and exit.
+///
+/// Only a peer running as allowed by AllowPeer(), this process' effective
+/// uid by default, is served. A path socket is made accessible to its owner
+/// only, so its directory must not let others replace it. An abstract name
+/// can be reached from the whole network namespace, the uid check is all
+/// that guards it.
+///
+/// The transfer runs on the loop thread and blocks it: nothing else is served
+/// until it ends, each send or receive waits up to HANDOVER_TIMEOUT_MS (5 s).
+/// Each connection sent gets on_closed_cb here. Until the new process
+/// confirms, this process keeps them open. If it does not confirm, they are
+/// adopted again and get on_new_client_cb.
+class HandoverServer : public IOEvent
+{
+    public:
+    typedef std::function<void (size_t) >   OnHandedOverCallback;   // sockets handed over
+
+    HandoverServer(const char* path, const OnHandedOverCallback& handed_over_cb = nullptr);
+    ~HandoverServer();
+
+    void AddServer(const string& name, TcpServer* server, bool with_connections = false);
+    /// The uid, and unless gid is -1 the gid, a new process must run as
+    void AllowPeer(uid_t uid, gid_t gid = (gid_t)-1);
+
+    private:
+    struct Entry
+    {
+        string      name;
+        TcpServer*  server;
+        bool        with_connections;
+    };
+    struct Detached
+    {
+        TcpServer*  server;
+        int         fd;
+        string      pending;
+    };
+
+    bool Listen();
+    void OnEvents(uint32_t events);
+    bool PeerAllowed(int fd);
+    size_t HandOver(int fd);
+    void Close();
+
+    private:
+    string                  path_;
+    std::vector<Entry>      servers_;
+    uid_t                   allowed_uid_;
+    gid_t                   allowed_gid_;
+    OnHandedOverCallback    handed_over_cb_;
+};
+
+/// The new process' side: fetches the sockets of the old process listening
+/// at path. false if there is none (a cold start) or the transfer failed,
+/// any socket received is closed then. Blocks at most timeout_ms per step.
+bool ReceiveHandover(const char* path, std::vector<HandoverSocket>& sockets, int timeout_ms = 5000);
+
+/// One socket and a payload per SOCK_SEQPACKET message, fd may be -1
+bool SendSocket(int sock, int fd, const string& payload);
+/// Returns the payload size or -1; fd is -1 if the message carries none
+int RecvSocket(int sock, int& fd, string& payload);
+
+}  // namespace evt_loop
+
+#endif  // _HANDOVER_H
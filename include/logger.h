@@ -0,0 +1,210 @@
+#ifndef _LOGGER_H
+#define _LOGGER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+enum LogLevel {
+  EL_LOG_LEVEL_DEBUG,
+  EL_LOG_LEVEL_INFO,
+  EL_LOG_LEVEL_WARN,
+  EL_LOG_LEVEL_ERROR,
+  EL_LOG_LEVEL_OFF,
+};
+
+/// Records below this level are compiled out together with their arguments,
+/// set it with LOG_LEVEL=0 (DEBUG) .. 4 (OFF), see src/Makefile
+#ifndef EL_LOG_LEVEL
+#define EL_LOG_LEVEL  EL_LOG_LEVEL_INFO
+#endif
+
+/// printf style, without the trailing newline. The never taken printf() lets
+/// the compiler check the format against the arguments.
+#define EL_LOG(level, fmt, ...)                                                     \
+  do {                                                                              \
+    if ((level) >= EL_LOG_LEVEL && (level) >= ::evt_loop::Logger::Level()) {        \
+      ::evt_loop::Logger::Write((level), fmt, ##__VA_ARGS__);                       \
+    }                                                                               \
+    if (false) printf(fmt, ##__VA_ARGS__);                                          \
+  } while (0)
+
+#define EL_LOG_DEBUG(fmt, ...)  EL_LOG(EL_LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define EL_LOG_INFO(fmt, ...)   EL_LOG(EL_LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define EL_LOG_WARN(fmt, ...)   EL_LOG(EL_LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define EL_LOG_ERROR(fmt, ...)  EL_LOG(EL_LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+
+namespace evt_loop {
+
+/// Formats the arguments stored behind a record, runs on the flusher thread
+typedef int (*LogFormatFunc)(char* out, size_t size, const char* fmt, const char* args);
+
+/// A record in the ring, the encoded arguments follow it
+struct LogRecord {
+  uint32_t      size;     // record and arguments, 8 byte aligned, 0 marks a wrap
+  uint32_t      level;
+  int64_t       time_us;
+  LogFormatFunc format;
+  const char*   fmt;      // a string literal, only the pointer is stored
+};
+
+/// How an argument is stored: scalars bit for bit, strings by value since
+/// the buffer they point to may be gone once the record is formatted
+template <typename T, bool IsString = std::is_same<T, const char*>::value || std::is_same<T, char*>::value>
+struct LogArg {
+  typedef T Type;
+  static size_t Size(const T&) { return sizeof(T); }
+  static char* Encode(char* out, const T& value) { memcpy(out, &value, sizeof(T)); return out + sizeof(T); }
+  static const char* Decode(const char* in, T& value) { memcpy(&value, in, sizeof(T)); return in + sizeof(T); }
+};
+
+template <typename T>
+struct LogArg<T, true> {
+  typedef const char* Type;
+  static size_t Size(const char* value) { return sizeof(uint32_t) + (value ? strlen(value) : 0) + 1; }
+  static char* Encode(char* out, const char* value) {
+    uint32_t len = value ? strlen(value) : 0;
+    memcpy(out, &len, sizeof(len));
+    if (len > 0) memcpy(out + sizeof(len), value, len);
+    out[sizeof(len) + len] = '\0';
+    return out + sizeof(len) + len + 1;
+  }
+  static const char* Decode(const char* in, const char*& value) {
+    uint32_t len = 0;
+    memcpy(&len, in, sizeof(len));
+    value = in + sizeof(len);
+    return in + sizeof(len) + len + 1;
+  }
+};
+
+template <typename... Args>
+struct LogArgs;
+
+template <>
+struct LogArgs<> {
+  static size_t Size() { return 0; }
+  static char* Encode(char* out) { return out; }
+  template <typename... Decoded>
+  static int Format(char* out, size_t size, const char* fmt, const char*, Decoded... decoded) {
+    return snprintf(out, size, fmt, decoded...);
+  }
+};
+
+template <typename T, typename... Rest>
+struct LogArgs<T, Rest...> {
+  static size_t Size(T value, Rest... rest) {
+    return LogArg<T>::Size(value) + LogArgs<Rest...>::Size(rest...);
+  }
+  static char* Encode(char* out, T value, Rest... rest) {
+    return LogArgs<Rest...>::Encode(LogArg<T>::Encode(out, value), rest...);
+  }
+  /// Decodes one argument per step and formats once all of them are out
+  template <typename... Decoded>
+  static int Format(char* out, size_t size, const char* fmt, const char* args, Decoded... decoded) {
+    typename LogArg<T>::Type value;
+    args = LogArg<T>::Decode(args, value);
+    return LogArgs<Rest...>::Format(out, size, fmt, args, decoded..., value);
+  }
+};
+
+/// Single producer, single consumer byte ring of one thread's records
+class LogRing {
+ public:
+  explicit LogRing(size_t capacity);
+  ~LogRing();
+
+  /// Producer side, NULL when the record does not fit or a signal handler
+  /// interrupted a record of the same thread (it is then dropped)
+  LogRecord* Reserve(size_t size);
+  void Commit();
+  /// Consumer side, formats every committed record with the sink
+  template <typename Sink>
+  size_t Drain(Sink& sink);
+
+  std::atomic<uint64_t> dropped;
+  std::atomic<bool>     retired;    // the owning thread has exited
+
+ private:
+  LogRing(const LogRing&);
+  LogRing& operator=(const LogRing&);
+
+ private:
+  char*                 buffer_;
+  size_t                capacity_;  // a power of two
+  size_t                pending_;   // head after the reserved record
+  std::atomic<bool>     writing_;   // between Reserve() and Commit()
+  std::atomic<size_t>   head_;      // written by the producer
+  std::atomic<size_t>   tail_;      // written by the consumer
+};
+
+template <typename Sink>
+size_t LogRing::Drain(Sink& sink) {
+  size_t tail = tail_.load(std::memory_order_relaxed);
+  size_t head = head_.load(std::memory_order_acquire);
+  size_t count = 0;
+  while (tail != head) {
+    size_t pos = tail & (capacity_ - 1);
+    const LogRecord* record = (const LogRecord*)(buffer_ + pos);
+    if (record->size == 0) {
+      tail += capacity_ - pos;  // the rest of the buffer was skipped
+      continue;
+    }
+    sink(record);
+    tail += record->size;
+    count++;
+  }
+  tail_.store(tail, std::memory_order_release);
+  return count;
+}
+
+/// Asynchronous logging. The loop thread only copies the format pointer and
+/// the raw arguments into its own ring; a background thread formats and
+/// writes them, so neither formatting nor a blocked stdout stalls the loop.
+/// A full ring drops records instead of waiting, the drops are reported.
+class Logger {
+ public:
+  static LogLevel Level() { return (LogLevel)level_.load(std::memory_order_relaxed); }
+  static void SetLevel(LogLevel level) { level_.store(level, std::memory_order_relaxed); }
+  /// Where records are written to, stdout by default
+  static void SetOutput(FILE* out);
+  /// Bytes of the ring of every thread logging from now on
+  static void SetRingSize(size_t size);
+  /// Writes everything logged so far, blocks the calling thread
+  static void Flush();
+
+  /// Arguments are taken by value so that arrays decay to pointers
+  template <typename... Args>
+  static void Write(LogLevel level, const char* fmt, Args... args) {
+    LogRing* ring = ThreadRing();
+    LogRecord* record = ring->Reserve(sizeof(LogRecord) + LogArgs<Args...>::Size(args...));
+    if (record == NULL) {
+      ring->dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    record->level = level;
+    record->time_us = NowMicros();
+    record->format = &LogArgs<Args...>::template Format<>;
+    record->fmt = fmt;
+    LogArgs<Args...>::Encode((char*)(record + 1), args...);
+    ring->Commit();
+    if (!running_.load(std::memory_order_relaxed)) {
+      Flush();  // the flusher has stopped at exit, write in place
+    }
+  }
+
+ private:
+  static LogRing* ThreadRing();
+  static int64_t NowMicros();
+  static void Stop();
+
+ private:
+  static std::atomic<int>   level_;
+  static std::atomic<bool>  running_;
+};
+
+}  // namespace evt_loop
+
+#endif  // _LOGGER_H
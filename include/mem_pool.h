@@ -0,0 +1,129 @@
+#ifndef _MEM_POOL_H
+#define _MEM_POOL_H
+
+#include <stddef.h>
+#include <new>
+#include <memory>
+#include <vector>
+
+namespace evt_loop {
+
+/// Free list of fixed size memory blocks. Released blocks are kept for reuse
+/// (up to max_free) instead of being handed back to malloc.
+class FixedSizePool {
+ public:
+  FixedSizePool(size_t block_size, size_t max_free = 65536)
+    : block_size_(block_size < sizeof(Node) ? sizeof(Node) : block_size),
+      max_free_(max_free), free_count_(0), free_list_(NULL) { }
+
+  void* Allocate() {
+    if (free_list_ == NULL) {
+      return ::operator new(block_size_);
+    }
+    Node* node = free_list_;
+    free_list_ = node->next;
+    free_count_--;
+    return node;
+  }
+  void Deallocate(void* p) {
+    if (free_count_ >= max_free_) {
+      ::operator delete(p);
+      return;
+    }
+    Node* node = static_cast<Node*>(p);
+    node->next = free_list_;
+    free_list_ = node;
+    free_count_++;
+  }
+  size_t FreeCount() const { return free_count_; }
+
+ private:
+  struct Node { Node* next; };
+
+  size_t  block_size_;
+  size_t  max_free_;
+  size_t  free_count_;
+  Node*   free_list_;
+};
+
+/// Pools are per thread, so every event loop thread owns its own free lists.
+/// They are intentionally never destroyed: objects may still be released
+/// while static objects are torn down at exit.
+template <size_t BlockSize>
+FixedSizePool& ThreadLocalPool() {
+  static thread_local FixedSizePool* pool = new FixedSizePool(BlockSize);
+  return *pool;
+}
+
+/// STL allocator drawing single objects from the thread's FixedSizePool,
+/// used with std::allocate_shared so that an object and its reference count
+/// share one pooled block.
+template <typename T>
+class PoolAllocator {
+ public:
+  typedef T value_type;
+
+  PoolAllocator() { }
+  template <typename U> PoolAllocator(const PoolAllocator<U>&) { }
+
+  T* allocate(size_t n) {
+    if (n == 1) return static_cast<T*>(ThreadLocalPool<sizeof(T)>().Allocate());
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+  void deallocate(T* p, size_t n) {
+    if (n == 1) ThreadLocalPool<sizeof(T)>().Deallocate(p);
+    else ::operator delete(p);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) { return false; }
+
+/// Recycles whole objects of type T, keeping the buffers they own warm.
+/// T must provide Recycle() to reset itself before reuse.
+template <typename T>
+class ObjectPool {
+ public:
+  static ObjectPool& Instance() {
+    static thread_local ObjectPool* pool = new ObjectPool();
+    return *pool;
+  }
+
+  std::shared_ptr<T> Acquire() {
+    T* obj = NULL;
+    if (free_.empty()) {
+      obj = new T();
+    } else {
+      obj = free_.back();
+      free_.pop_back();
+    }
+    return std::shared_ptr<T>(obj, Recycler(), PoolAllocator<T>());
+  }
+  void Release(T* obj) {
+    if (free_.size() >= max_free_) {
+      delete obj;
+      return;
+    }
+    obj->Recycle();
+    free_.push_back(obj);
+  }
+  void SetMaxFree(size_t max_free) { max_free_ = max_free; }
+  size_t FreeCount() const { return free_.size(); }
+
+ private:
+  struct Recycler {
+    void operator()(T* obj) const { ObjectPool<T>::Instance().Release(obj); }
+  };
+
+  ObjectPool() : max_free_(4096) { free_.reserve(max_free_); }
+
+ private:
+  std::vector<T*> free_;
+  size_t          max_free_;
+};
+
+}  // namespace evt_loop
+
+#endif  // _MEM_POOL_H
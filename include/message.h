@@ -1,12 +1,24 @@
 #ifndef _MESSAGE_H
 #define _MESSAGE_H
 
+#include <stdio.h>
 #include <string.h>
-#include <queue>
+#include <string>
+#include <functional>
 #include <memory>
+#include "mem_pool.h"
+#include "ring_queue.h"
+#include "simd_scan.h"
+#include "tlv.h"
+#include "crc32c.h"
 
 #define UNUSED(var) ((void)var)
 
+/// Recycled messages keep their buffer for reuse unless it grew beyond this
+#define MAX_RECYCLED_CAPACITY   (64 * 1024)
+/// A frame header is not trusted with more than this before its bytes arrive
+#define MAX_UPFRONT_RESERVE     (256 * 1024)
+
 namespace evt_loop {
 
 enum MessageType {
@@ -15,11 +27,14 @@ enum MessageType {
   CRLF,
   JSON,
   TLV,
+  NDJSON,     // newline-delimited JSON, one value per line
+  CUSTOM,     // framed by a user Framer, see framer.h
 };
 
 class Message {
   public:
   Message(MessageType type) : type_(type) { }
+  virtual ~Message() { }
 
   virtual size_t MoreSize() const = 0;
   virtual bool Completion() const = 0;
@@ -31,9 +46,33 @@ class Message {
   size_t Size() const             { return data_.size(); }
   bool Empty() const              { return data_.empty(); }
 
+  /// Appends bytes verbatim, bypassing the framer (used to build outgoing frames)
+  void AppendRawData(const char* data, size_t length) { data_.append(data, length); }
+  void Reserve(size_t size)               { data_.reserve(size); }
+
   virtual void Clear()                    { data_.clear(); }
   virtual const char* Payload() const     { return data_.data(); }
   virtual size_t PayloadSize() const      { return data_.size(); }
+  /// Size of the whole frame once its header is decoded, 0 while unknown or
+  /// for formats without a length (CRLF, JSON)
+  virtual size_t ExpectedSize() const     { return 0; }
+  /// Bytes in front of the payload
+  virtual size_t HeaderSize() const       { return 0; }
+  /// False when a received message fails its integrity check
+  virtual bool Intact() const             { return true; }
+  /// True once a received header turned out undecodable, the message takes
+  /// no more data then
+  virtual bool Malformed() const          { return false; }
+  /// Copies a message whose type CreateMessage() does not know (CUSTOM)
+  virtual std::shared_ptr<Message> Clone() const { return std::shared_ptr<Message>(); }
+
+  /// Resets the message before it goes back to its ObjectPool
+  void Recycle() {
+    Clear();
+    if (data_.capacity() > MAX_RECYCLED_CAPACITY) {
+      std::string().swap(data_);
+    }
+  }
 
   protected:
   MessageType   type_;
@@ -42,34 +81,42 @@ class Message {
 
 class CRLFMessage : public Message {
   public:
-  CRLFMessage() : Message(MessageType::CRLF) { }
+  CRLFMessage() : Message(MessageType::CRLF), complete_(false) { }
 
-  CRLFMessage(const std::string& data) : Message(MessageType::CRLF) {
+  CRLFMessage(const std::string& data) : Message(MessageType::CRLF), complete_(false) {
     AssignData(data.data(), data.size());
   }
-  CRLFMessage(const char* data, uint32_t length) : Message(MessageType::CRLF) {
+  CRLFMessage(const char* data, uint32_t length) : Message(MessageType::CRLF), complete_(false) {
     AssignData(data, length);
   }
   CRLFMessage(const CRLFMessage& other) : Message(MessageType::CRLF) {
     data_ = other.data_;
+    complete_ = other.complete_;
   }
   CRLFMessage& operator=(const CRLFMessage& rvalue) {
     data_ = rvalue.data_;
+    complete_ = rvalue.complete_;
     return *this;
   }
 
-  size_t MoreSize() const { return 1024; }
-  bool Completion() const { return !memcmp((char*)&data_[data_.size() - 2], TERMINAL_LABEL, 2); }
+  size_t MoreSize() const { return 4096; }
+  bool Completion() const { return complete_; }
   size_t AppendData(const char* data, uint32_t size);
   size_t AssignData(const char* data, uint32_t size, bool has_hdr = false);
+  void Clear()            { Message::Clear(); complete_ = false; }
 
   private:
-  static const char* TERMINAL_LABEL;
+  bool complete_;
 };
 
+/// Frames complete top-level JSON values (objects, arrays and strings).
+/// Brackets inside string literals and escaped quotes are skipped, the
+/// structural bytes are located with a vectorized scan. Whitespace between
+/// values is dropped, any other byte there makes the stream malformed.
+/// NDJSON frames lines instead, blank lines are dropped.
 class JsonMessage : public Message {
   public:
-  JsonMessage() : Message(MessageType::JSON), lbc_(0), rbc_(0) { }
+  JsonMessage(MessageType type = MessageType::JSON) : Message(type) { Reset(); }
 
   JsonMessage(const std::string& data) : Message(MessageType::JSON) {
     AssignData(data.data(), data.size());
@@ -77,26 +124,51 @@ class JsonMessage : public Message {
   JsonMessage(const char* data, uint32_t length) : Message(MessageType::JSON) {
     AssignData(data, length);
   }
-  JsonMessage(const JsonMessage& other) : Message(MessageType::JSON) {
-    data_ = other.data_;
+  JsonMessage(const JsonMessage& other) : Message(other.type_) {
+    *this = other;
   }
   JsonMessage& operator=(const JsonMessage& rvalue) {
     data_ = rvalue.data_;
+    depth_ = rvalue.depth_;
+    in_string_ = rvalue.in_string_;
+    escape_ = rvalue.escape_;
+    started_ = rvalue.started_;
+    complete_ = rvalue.complete_;
+    malformed_ = rvalue.malformed_;
     return *this;
   }
 
   size_t MoreSize() const { return 4096; }
-  bool Completion() const { return lbc_ != 0 && lbc_ == rbc_; }
+  bool Completion() const { return complete_; }
+  bool Malformed() const  { return malformed_; }
   size_t AppendData(const char* data, uint32_t size);
   size_t AssignData(const char* data, uint32_t size, bool has_hdr = false);
-  
+  void Clear()            { Message::Clear(); Reset(); }
+
   private:
-  size_t lbc_;
-  size_t rbc_;;
+  void Reset() { depth_ = 0; in_string_ = escape_ = started_ = complete_ = malformed_ = false; }
+  size_t AppendLine(const char* data, uint32_t size);
+
+  private:
+  size_t  depth_;       // nesting level of objects and arrays
+  bool    in_string_;
+  bool    escape_;      // the previous byte in a string was a backslash
+  bool    started_;     // the value (or line) has begun
+  bool    complete_;
+  bool    malformed_;   // a byte between values can not start one
+};
+
+/// Newline-delimited JSON: a message is one line holding one JSON value,
+/// blank lines are skipped
+class NdJsonMessage : public JsonMessage {
+  public:
+  NdJsonMessage() : JsonMessage(MessageType::NDJSON) { }
 };
 
 class BinaryMessage : public Message {
   public:
+  /// With _BINARY_MSG_EXTEND_PACKAGING the header is 16 bytes. flags and
+  /// checksum made it grow from 11, so both ends must be built with them.
 #pragma pack(1)
   struct HDR {
     uint32_t  length;
@@ -104,14 +176,16 @@ class BinaryMessage : public Message {
     uint16_t  msg_type;
     uint32_t  msg_id;
     uint8_t   protocol;
+    uint8_t   flags;
+    uint32_t  checksum;   // CRC32C of the payload, valid with FLAG_CHECKSUM
 #endif
     char      payload[0];
     HDR()     { memset(this, 0, sizeof(*this)); }
     std::string ToString() const {
-      char buffer[128];
+      char buffer[160];
 #ifdef _BINARY_MSG_EXTEND_PACKAGING
-      snprintf(buffer, sizeof(buffer), "{ length: %u, msg_type: %u, msg_id: %u, protocol: %u }",
-          length, msg_type, msg_id, protocol);
+      snprintf(buffer, sizeof(buffer), "{ length: %u, msg_type: %u, msg_id: %u, protocol: %u, flags: %u, checksum: %08x }",
+          length, msg_type, msg_id, protocol, flags, checksum);
 #else
       snprintf(buffer, sizeof(buffer), "{ length: %u }", length);
 #endif
@@ -121,9 +195,17 @@ class BinaryMessage : public Message {
 #pragma pack()
 
   enum { HAS_NO_HDR = false, HAS_HDR = true };
+  /// Bits of HDR::flags
+  enum {
+    FLAG_CHECKSUM = 1 << 0,
+    FLAG_LZ4      = 1 << 1,   // the payload is a compressed block, see compressor.h
+    FLAG_ZSTD     = 1 << 2,
+    FLAG_FRAGMENT = 1 << 3,   // a piece of a larger message, see tx_scheduler.h
+    FLAG_MORE_FRAGMENTS = 1 << 4,
+  };
 
   public:
-  BinaryMessage() : Message(MessageType::BINARY), hdr_(NULL) { }
+  BinaryMessage() : Message(MessageType::BINARY), hdr_(NULL), crc_(0) { }
   BinaryMessage(const std::string& data, bool has_hdr = HAS_HDR);
   BinaryMessage(const char* data, uint32_t length, bool has_hdr = HAS_HDR);
   BinaryMessage(const BinaryMessage& other);
@@ -140,38 +222,129 @@ class BinaryMessage : public Message {
   const char* Payload() const     { return (char*)(hdr_->payload); }
   size_t PayloadSize() const      { return hdr_ == NULL ? 0 : hdr_->length - sizeof(HDR); }
   bool Completion() const         { return hdr_ && hdr_->length == data_.size(); }
-  void Clear()                    { Message::Clear(); hdr_ = NULL; }
+  void Clear()                    { Message::Clear(); hdr_ = NULL; crc_ = 0; }
+  size_t ExpectedSize() const     { return hdr_ == NULL ? 0 : hdr_->length; }
+  size_t HeaderSize() const       { return sizeof(HDR); }
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+  /// Stamps the CRC32C of the payload into the header
+  void SetChecksum() {
+    hdr_->checksum = Crc32c(Payload(), PayloadSize());
+    hdr_->flags |= FLAG_CHECKSUM;
+  }
+  /// The checksum is accumulated while the payload is appended
+  bool Intact() const {
+    return hdr_ == NULL || !(hdr_->flags & FLAG_CHECKSUM) || crc_ == hdr_->checksum;
+  }
+#endif
 
   private:
   HDR*          hdr_;
+  uint32_t      crc_;   // CRC32C of the payload received so far
+};
+
+/// One top-level TLV record per message, see tlv.h for the wire format and
+/// for decoding the value against a schema
+class TLVMessage : public Message {
+  public:
+  enum { DEFAULT_TAG = 0 };
+
+  TLVMessage() : Message(MessageType::TLV) { }
+  TLVMessage(uint16_t tag, const char* value, uint32_t length) : Message(MessageType::TLV) {
+    Assign(tag, value, length);
+  }
+  TLVMessage(const TLVMessage& other) : Message(MessageType::TLV) {
+    data_ = other.data_;
+  }
+  TLVMessage& operator=(const TLVMessage& rvalue) {
+    data_ = rvalue.data_;
+    return *this;
+  }
+
+  size_t MoreSize() const;
+  bool Completion() const         { return Header() != NULL && data_.size() == sizeof(TlvHeader) + Header()->length; }
+  size_t AppendData(const char* data, uint32_t length);
+  /// Without has_hdr the data is the value of a record tagged DEFAULT_TAG
+  size_t AssignData(const char* data, uint32_t length, bool has_hdr = false);
+  size_t Assign(uint16_t tag, const char* value, uint32_t length);
+
+  const TlvHeader* Header() const { return data_.size() >= sizeof(TlvHeader) ? (const TlvHeader*)data_.data() : NULL; }
+  uint16_t Tag() const            { return Header() ? Header()->tag : 0; }
+  size_t ExpectedSize() const     { return Header() ? sizeof(TlvHeader) + Header()->length : 0; }
+  size_t HeaderSize() const       { return sizeof(TlvHeader); }
+  const char* Payload() const     { return data_.data() + sizeof(TlvHeader); }
+  size_t PayloadSize() const      { return Header() ? Header()->length : 0; }
+  /// The nested records of the value, viewed in place
+  TlvView Value() const           { return TlvView(Payload(), PayloadSize()); }
 };
 
 typedef std::shared_ptr<Message>  MessagePtr;
 
+/// A piece of the payload of a message too large to be buffered, see
+/// BufferIOEvent::SetStreamThreshold()
+struct MessageChunk {
+  const Message*  msg;      // holds the frame header only
+  const char*     data;
+  size_t          size;
+  size_t          offset;   // of data within the payload
+  size_t          total;    // payload size
+
+  bool Last() const { return offset + size == total; }
+};
+
+/// Upper bound of a frame header written by a Framer
+#define MAX_FRAME_HEADER_SIZE   32
+
+/// The entry points of a user Framer with its type erased, so connections
+/// can carry one without becoming templates. Made by MakeFraming<F>().
+struct Framing {
+  typedef MessagePtr (*Factory)();
+  typedef size_t (*HeaderWriter)(char* out, size_t payload_size);
+
+  Framing() : create(NULL), write_header(NULL) { }
+  bool Valid() const { return create != NULL; }
+
+  Factory       create;
+  HeaderWriter  write_header;
+};
+
 MessagePtr CreateMessage(MessageType msg_type);
 MessagePtr CreateMessage(MessageType msg_type, const char* data, size_t length, bool bmsg_has_no_hdr = BinaryMessage::HAS_NO_HDR);
 MessagePtr CreateMessage(const Message& msg);
+MessagePtr CreateMessage(const Framing& framing, const char* data, size_t length, bool has_hdr = false);
 
 class MessageMQ {
   public:
-  typedef std::function<void (const Message*) > MessageDispatcher;
+  typedef std::function<void (MessagePtr&) > MessageDispatcher;
+
+  MessageMQ() : msg_type_(MessageType::UNKNOWN), size_limit_(0) { }
 
-  void SetMessageType(const MessageType& msg_type) { msg_type_ = msg_type; }
+  void SetMessageType(const MessageType& msg_type) { msg_type_ = msg_type; framing_ = Framing(); }
+  void SetFraming(const Framing& framing) { msg_type_ = MessageType::CUSTOM; framing_ = framing; }
   size_t Size() const { return mq_.size(); }
   bool Empty() const { return mq_.empty(); }
-  void Clear() { while (!mq_.empty()) { mq_.pop(); } }
+  void Clear() { mq_.clear(); }
   MessagePtr& Last();
   void Push(const MessagePtr& msg) { mq_.push(msg); }
   MessagePtr& First();
+  MessagePtr& At(size_t i) { return mq_[i]; }
   void EraseFirst() { mq_.pop(); }
 
   size_t NeedMore() { return Last()->MoreSize(); }
-  void AppendData(const char* data, uint32_t size);
+  /// Frames the data and returns how much of it was taken. Stops early at an
+  /// incomplete message whose header announces more than the size limit, and
+  /// at a malformed message or one taking no more data.
+  size_t AppendData(const char* data, uint32_t size);
+  void SetSizeLimit(size_t size_limit) { size_limit_ = size_limit; }
   void Apply(MessageDispatcher& cb);
 
+  private:
+  MessagePtr NewMessage() { return framing_.Valid() ? framing_.create() : CreateMessage(msg_type_); }
+
   private:
   MessageType msg_type_;
-  std::queue<MessagePtr> mq_;
+  Framing     framing_;
+  size_t      size_limit_;    // 0 means unlimited
+  RingQueue<MessagePtr> mq_;
 };
 
 }  // evt_loop
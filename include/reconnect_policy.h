@@ -0,0 +1,66 @@
+#ifndef _RECONNECT_POLICY_H
+#define _RECONNECT_POLICY_H
+
+#include <stdint.h>
+#include "utils.h"
+
+namespace evt_loop {
+
+/// When to try again after a connect failed or a connection was lost. The
+/// delay grows from base_delay_ms by multiplier per attempt up to
+/// max_delay_ms. With full jitter the delay is drawn uniformly from
+/// [0, that delay]. Clients that lost the same backend then spread over
+/// the whole window instead of coming back in lockstep.
+struct ReconnectPolicy
+{
+    uint32_t    base_delay_ms;
+    uint32_t    max_delay_ms;
+    double      multiplier;
+    bool        full_jitter;
+    uint32_t    max_attempts;   // in a row before giving up, 0 means never
+    uint32_t    stable_ms;      // a connection lasting this long resets the backoff
+
+    ReconnectPolicy();
+    /// The same delay every time, without jitter
+    static ReconnectPolicy Fixed(uint32_t delay_ms, uint32_t max_attempts = 0);
+};
+
+struct ReconnectStats
+{
+    uint64_t    attempts;               // connects tried by the policy
+    uint64_t    reconnects;             // of them, the ones that got connected
+    uint64_t    give_ups;               // times max_attempts ran out
+    uint32_t    consecutive_failures;   // attempts since the last stable connection
+    uint32_t    last_delay_ms;
+
+    ReconnectStats() : attempts(0), reconnects(0), give_ups(0), consecutive_failures(0), last_delay_ms(0) { }
+};
+
+/// The reconnect state of one client
+class ReconnectBackoff
+{
+    public:
+    ReconnectBackoff(const ReconnectPolicy& policy = ReconnectPolicy()) : policy_(policy), connected_(false) { }
+
+    void SetPolicy(const ReconnectPolicy& policy) { policy_ = policy; }
+    const ReconnectPolicy& Policy() const { return policy_; }
+    const ReconnectStats& Stats() const { return stats_; }
+
+    /// The delay before the next attempt, false once max_attempts are used up
+    bool NextDelay(uint32_t& delay_ms);
+    void OnConnected();
+    /// The backoff starts over from base_delay_ms only if the connection
+    /// lasted stable_ms. A server accepting and closing right away (e.g.
+    /// when it is out of fds) keeps its clients backing off.
+    void OnDisconnected();
+
+    private:
+    ReconnectPolicy policy_;
+    ReconnectStats  stats_;
+    bool            connected_;
+    TimeVal         connected_at_;
+};
+
+}  // namespace evt_loop
+
+#endif  // _RECONNECT_POLICY_H
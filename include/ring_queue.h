@@ -0,0 +1,61 @@
+#ifndef _RING_QUEUE_H
+#define _RING_QUEUE_H
+
+#include <stddef.h>
+#include <vector>
+#include <utility>
+
+namespace evt_loop {
+
+/// FIFO on a growable circular array. Unlike std::queue (std::deque) it does
+/// not allocate and free nodes while elements flow through it.
+template <typename T>
+class RingQueue {
+ public:
+  RingQueue() : head_(0), count_(0) { }
+
+  size_t size() const { return count_; }
+  bool empty() const { return count_ == 0; }
+
+  T& front() { return slots_[head_]; }
+  const T& front() const { return slots_[head_]; }
+  T& back() { return slots_[Index(count_ - 1)]; }
+  const T& back() const { return slots_[Index(count_ - 1)]; }
+  T& operator[](size_t i) { return slots_[Index(i)]; }
+  const T& operator[](size_t i) const { return slots_[Index(i)]; }
+
+  void push(const T& value) {
+    if (count_ == slots_.size()) Grow();
+    slots_[Index(count_)] = value;
+    count_++;
+  }
+  void pop() {
+    slots_[head_] = T();   // release the element now
+    head_ = Index(1);
+    count_--;
+  }
+  void clear() {
+    while (count_ > 0) pop();
+    head_ = 0;
+  }
+
+ private:
+  size_t Index(size_t i) const { return (head_ + i) & (slots_.size() - 1); }
+  void Grow() {
+    std::vector<T> slots(slots_.empty() ? 8 : slots_.size() * 2);
+    for (size_t i = 0; i < count_; i++) {
+      slots[i] = std::move(slots_[Index(i)]);
+    }
+    slots_.swap(slots);
+    head_ = 0;
+  }
+
+ private:
+  std::vector<T>  slots_;   // size is always a power of 2
+  size_t          head_;
+  size_t          count_;
+};
+
+}  // namespace evt_loop
+
+#endif  // _RING_QUEUE_H
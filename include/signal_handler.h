@@ -6,6 +6,7 @@
 #include <map>
 #include <functional>
 #include "event.h"
+#include "logger.h"
 
 using std::set;
 using std::map;
@@ -72,7 +73,7 @@ class SignalHandler : public SignalEvent
 
   private:
   void OnEvents(uint32_t events) {
-    printf("SignalHandler receives signal (%d).\n", events);
+    EL_LOG_INFO("SignalHandler receives signal (%d).", events);
     signal_cb_(this, events);
   }
 
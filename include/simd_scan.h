@@ -0,0 +1,83 @@
+#ifndef _SIMD_SCAN_H
+#define _SIMD_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace evt_loop {
+
+/// Returns the first occurrence of byte c in [data, data + size), or NULL.
+/// Scans 32 bytes per step with AVX2 (build with -mavx2), 16 with SSE2.
+inline const char* FindByte(const char* data, size_t size, char c)
+{
+  const char* p = data;
+  const char* end = data + size;
+#if defined(__AVX2__)
+  const __m256i needle32 = _mm256_set1_epi8(c);
+  for (; p + 32 <= end; p += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i*)p);
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle32));
+    if (mask) return p + __builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i needle16 = _mm_set1_epi8(c);
+  for (; p + 16 <= end; p += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i*)p);
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle16));
+    if (mask) return p + __builtin_ctz(mask);
+  }
+  for (; p < end; p++) {
+    if (*p == c) return p;
+  }
+  return NULL;
+#else
+  return (const char*)memchr(p, c, end - p);
+#endif
+}
+
+/// Returns the first byte in [data, data + size) that equals one of the n
+/// (at most 8) bytes of set, or NULL.
+inline const char* FindAnyOf(const char* data, size_t size, const char* set, int n)
+{
+  const char* p = data;
+  const char* end = data + size;
+#if defined(__AVX2__)
+  __m256i needles32[8];
+  for (int k = 0; k < n; k++) needles32[k] = _mm256_set1_epi8(set[k]);
+  for (; p + 32 <= end; p += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i*)p);
+    __m256i hits = _mm256_cmpeq_epi8(block, needles32[0]);
+    for (int k = 1; k < n; k++) hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, needles32[k]));
+    uint32_t mask = _mm256_movemask_epi8(hits);
+    if (mask) return p + __builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  __m128i needles16[8];
+  for (int k = 0; k < n; k++) needles16[k] = _mm_set1_epi8(set[k]);
+  for (; p + 16 <= end; p += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i*)p);
+    __m128i hits = _mm_cmpeq_epi8(block, needles16[0]);
+    for (int k = 1; k < n; k++) hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles16[k]));
+    uint32_t mask = _mm_movemask_epi8(hits);
+    if (mask) return p + __builtin_ctz(mask);
+  }
+#endif
+  for (; p < end; p++) {
+    for (int k = 0; k < n; k++) {
+      if (*p == set[k]) return p;
+    }
+  }
+  return NULL;
+}
+
+}  // namespace evt_loop
+
+#endif  // _SIMD_SCAN_H
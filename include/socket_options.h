@@ -0,0 +1,49 @@
+#ifndef _SOCKET_OPTIONS_H
+#define _SOCKET_OPTIONS_H
+
+#include <string>
+
+using std::string;
+
+namespace evt_loop {
+
+/// Socket tuning of a server or client. A field left at -1 keeps the system
+/// default. Options set on a listening socket are inherited by the sockets
+/// it accepts; only TCP_QUICKACK, which the kernel clears as it goes, is
+/// re-armed per connection. TCP level options are skipped on unix sockets.
+struct SocketOptions
+{
+    int tcp_nodelay;        // 1 disables Nagle's algorithm
+    int tcp_quickack;       // 1 acknowledges right away instead of delaying
+    int sndbuf;             // SO_SNDBUF / SO_RCVBUF bytes, fixed sizes turn off autotuning
+    int rcvbuf;
+    int notsent_lowat;      // TCP_NOTSENT_LOWAT, unsent bytes at most before writable
+    int defer_accept;       // TCP_DEFER_ACCEPT seconds, listeners only
+    int fastopen;           // TCP_FASTOPEN queue length, listeners only
+    int keepalive;          // 1 enables SO_KEEPALIVE with the three below
+    int keepidle;           // seconds
+    int keepintvl;          // seconds
+    int keepcnt;
+    int busy_poll;          // SO_BUSY_POLL microseconds, above net.core.busy_read needs CAP_NET_ADMIN
+
+    SocketOptions();
+
+    /// Request/response traffic: no Nagle, no delayed ACKs, little unsent data
+    static SocketOptions LowLatency();
+    /// Throughput: large fixed buffers
+    static SocketOptions Bulk();
+    /// Long, lossy paths: keepalive to notice dead peers, fast open for clients that use it
+    static SocketOptions Wan();
+    /// "default", "low-latency", "bulk" or "wan", false for any other name
+    static bool FromProfile(const string& name, SocketOptions& opts);
+
+    /// Return false if an option was refused, the others are applied anyway
+    bool ApplyListener(int fd) const;
+    /// Before connect()
+    bool ApplyClient(int fd) const;
+    bool ApplyConnection(int fd) const;
+};
+
+}  // namespace evt_loop
+
+#endif  // _SOCKET_OPTIONS_H
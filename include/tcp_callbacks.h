@@ -1,17 +1,21 @@
 #ifndef _TCP_CALLBACKS_H
 #define _TCP_CALLBACKS_H
 
-#include <stdio.h>
 #include <functional>
 #include <memory>
+#include "message.h"
+#include "logger.h"
 
 namespace evt_loop {
 
 class TcpConnection;
-class Message;
 
 typedef std::function<void (TcpConnection*, const Message*) >       OnMsgRecvdCallback;
+typedef std::function<void (TcpConnection*, MessagePtr&) >          OnMsgRecvdPtrCallback;
+typedef std::function<void (TcpConnection*, const Message* const*, size_t) > OnMsgsRecvdCallback;
+typedef std::function<void (TcpConnection*, const MessageChunk&) >  OnMsgChunkCallback;
 typedef std::function<void (TcpConnection*, const Message*) >       OnMsgSentCallback;
+typedef std::function<void (TcpConnection*, size_t) >               OnWatermarkCallback;
 typedef std::function<void (TcpConnection*) >                       OnNewClientCallback;
 typedef std::function<void (TcpConnection*) >                       OnClosedCallback;
 typedef std::function<void (int, const char*) >                     OnErrorCallback;
@@ -28,17 +32,33 @@ struct TcpCallbacks {
 
     public:
     OnMsgRecvdCallback  on_msg_recvd_cb;
+    /// Optional, takes precedence over on_msg_recvd_cb when set. The handler may
+    /// move the message out (e.g. to Send(std::move(msg))) to keep it without a copy.
+    OnMsgRecvdPtrCallback on_msg_recvd_ptr_cb;
+    /// Optional, takes precedence over both above when set. Receives every
+    /// message completed by one read in a single call, so a handler can share
+    /// one pipeline, transaction or lock among them. The messages are valid
+    /// during the call only.
+    OnMsgsRecvdCallback on_msgs_recvd_cb;
+    /// Optional, receives the payload of messages above the stream threshold
+    /// (TcpConnection::SetStreamThreshold) in pieces
+    OnMsgChunkCallback  on_msg_chunk_cb;
     OnMsgSentCallback   on_msg_sent_cb;
+    /// Optional, the output buffer of the connection has grown beyond its high
+    /// watermark (TcpConnection::SetWriteWatermarks), stop producing for it
+    OnWatermarkCallback on_high_watermark_cb;
+    /// Optional, the output buffer has drained to the low watermark again
+    OnWatermarkCallback on_low_watermark_cb;
     OnNewClientCallback on_new_client_cb;
     OnClosedCallback    on_closed_cb;
     OnErrorCallback     on_error_cb;
 
     private:
-    void EmptyMsgRecvdCb(TcpConnection*, const Message*)        { printf("Empty Message Received Callback\n"); }
-    void EmptyMsgSentCb(TcpConnection*, const Message*)         { printf("Empty Message Sent Callback\n"); }
-    void EmptyNewClientCb(TcpConnection*)                       { printf("Empty New Client Callback\n"); }
-    void EmptyClosedCb(TcpConnection*)                          { printf("Empty Connection Closed Callback\n"); }
-    void EmptyErrorCb(int, const char*)                         { printf("Empty Connection Error Callback\n"); }
+    void EmptyMsgRecvdCb(TcpConnection*, const Message*)        { EL_LOG_DEBUG("Empty Message Received Callback"); }
+    void EmptyMsgSentCb(TcpConnection*, const Message*)         { EL_LOG_DEBUG("Empty Message Sent Callback"); }
+    void EmptyNewClientCb(TcpConnection*)                       { EL_LOG_DEBUG("Empty New Client Callback"); }
+    void EmptyClosedCb(TcpConnection*)                          { EL_LOG_DEBUG("Empty Connection Closed Callback"); }
+    void EmptyErrorCb(int, const char*)                         { EL_LOG_DEBUG("Empty Connection Error Callback"); }
 };
 
 typedef std::shared_ptr<TcpCallbacks>           TcpCallbacksPtr;
@@ -5,33 +5,60 @@
 #include <list>
 #include "tcp_connection.h"
 #include "timer_handler.h"
+#include "socket_options.h"
+#include "reconnect_policy.h"
 
 using std::string;
 using std::list;
 
+/// Shared by the clients connecting without blocking
+#define DEFAULT_CONNECT_TIMEOUT_MS  5000
+
 namespace evt_loop {
 
 class TcpClient : public IOEvent
 {
     public:
+      /// host as for TcpServer: IPv4, IPv6, "unix:/path" or "unix:@name"
       TcpClient(const char *host, uint16_t port, MessageType msg_type = MessageType::BINARY,
           bool auto_reconnect = true, TcpCallbacksPtr tcp_evt_cbs = nullptr);
     ~TcpClient();
+    /// Starts connecting without blocking, true if the connection is made or
+    /// under way. on_new_client_cb is called once it is established.
     bool Connect();
     void Disconnect();
     bool Send(const string& msg);
     void SetTcpCallbacks(const TcpCallbacksPtr& tcp_evt_cbs);
+    void SetFraming(const Framing& framing);
+    /// Applied to the current connection and to every one made from now on
+    void SetSocketOptions(const SocketOptions& opts);
+    /// A connect taking longer fails with ETIMEDOUT, 0 waits for the kernel.
+    /// A connect under way is given this long from now.
+    void SetConnectTimeout(uint32_t timeout_ms);
+    bool Connecting() const { return connecting_; }
+    /// How auto reconnect spaces its attempts, exponential backoff with full
+    /// jitter from 1 s up to 30 s by default. A connection closed within
+    /// stable_ms counts as a failed attempt. Once max_attempts in a row have
+    /// failed, on_error_cb gets ECONNABORTED and the client stays
+    /// disconnected until Connect() is called.
+    void SetReconnectPolicy(const ReconnectPolicy& policy);
+    const ReconnectStats& GetReconnectStats() const { return backoff_.Stats(); }
     TcpConnectionPtr& Connection() { return conn_; }
     int FD() const { return (conn_ ? conn_->FD() : -1); }  // Overrides interface of base class IOEvent
     
     private:
-    void OnEvents(uint32_t events) {}
+    /// The base IOEvent watches the socket while it connects
+    void OnEvents(uint32_t events);
     void SetFD(int fd) { if (conn_) conn_->SetFD(fd); }  // Hides interface of base class IOEvent
 
     bool Connect_();
     void Reconnect();
+    void FinishConnect(int fd);
+    int  StopConnecting();
+    void OnConnectFailed(int errcode, const char* errstr);
+    void OnConnectTimer(PeriodicTimer* timer);
 
-    void OnConnected(int fd, const IPAddress& local_addr);
+    void OnConnected(int fd, const SockAddr& local_addr, const SockAddr& peer_addr);
     void OnConnectionClosed(TcpConnection* conn);
     void OnError(int errcode, const char* errstr);
     void OnReconnectTimer(PeriodicTimer* timer);
@@ -41,10 +68,17 @@ class TcpClient : public IOEvent
   private:
     IPAddress           server_addr_;
     MessageType         msg_type_;
+    Framing             framing_;
+    SocketOptions       sock_opts_;
     bool                auto_reconnect_;
     TcpConnectionPtr    conn_;
     list<string>        tmp_sendbuf_list_;
-    PeriodicTimer       reconnect_timer_;
+    PeriodicTimer       reconnect_timer_;     // one shot, rescheduled by backoff_
+    ReconnectBackoff    backoff_;
+    SockAddr            peer_addr_;         // of the connect under way
+    bool                connecting_;
+    uint32_t            connect_timeout_ms_;
+    PeriodicTimer       connect_timer_;
 
     TcpCallbacksPtr     tcp_evt_cbs_;
 };
@@ -2,6 +2,8 @@
 #define _TCP_CONNECTION_H
 
 #include <map>
+#include <set>
+#include <vector>
 #include <memory>
 
 #include "fd_handler.h"
@@ -13,42 +15,124 @@ using std::shared_ptr;
 
 namespace evt_loop {
 
+class TcpRelay;
+
 class TcpConnection : public BufferIOEvent
 {
   public:
-    TcpConnection(int fd, const IPAddress& local_addr, const IPAddress& peer_addr,
-            const OnClosedCallback& close_cb, TcpCallbacksPtr tcp_evt_cbs = nullptr);
+    TcpConnection(int fd, const SockAddr& local_addr, const SockAddr& peer_addr,
+            const OnClosedCallback& close_cb, TcpCallbacksPtr tcp_evt_cbs = nullptr,
+            uint32_t events = IOEvent::READ | IOEvent::ERROR);
     ~TcpConnection();
 
     uint32_t ID() const { return id_; }
     void SetID(uint32_t id) { id_ = id; }
 
     void Disconnect();
+    /// Gives up the socket without closing it, to hand it over to another
+    /// process. Received bytes of an incomplete message are moved to pending.
+    /// Returns the fd, -1 if the connection is not idle, relayed, or has more
+    /// than max_pending bytes (0: any number) of such a message. on_closed_cb
+    /// is called before it lets go, anything referring to the connection
+    /// must be dropped there as when it closes.
+    int Detach(string& pending, size_t max_pending = 0);
 
     void SetTcpCallbacks(const TcpCallbacksPtr& tcp_evt_cbs);
 
-    const IPAddress& GetLocalAddr() const;
-    const IPAddress& GetPeerAddr() const;
+    /// The path of a unix domain socket is read from the socket
+    IPAddress GetLocalAddr() const;
+    IPAddress GetPeerAddr() const;
+    const SockAddr& LocalSockAddr() const { return local_addr_; }
+    const SockAddr& PeerSockAddr() const { return peer_addr_; }
+
+    /// The kernel falls back to delayed ACKs as it sees fit, so TCP_QUICKACK
+    /// is set again before every read
+    void SetQuickAck(bool enable) { quickack_ = enable; }
+
+    TcpRelay* Relay() const { return relay_; }
+    void SetRelay(TcpRelay* relay) { relay_ = relay; }
 
   protected:
     void Destroy();
+    void OnEvents(uint32_t events);
     void OnReceived(const Message* buffer);
+    void OnReceivedMessage(MessagePtr& msg);
+    void OnReceivedChunk(const MessageChunk& chunk);
+    void OnReceivedBatch(std::vector<MessagePtr>& msgs);
     void OnSent(const Message* buffer);
+    void OnHighWatermark(size_t queued);
+    void OnLowWatermark(size_t queued);
     void OnClosed();
     void OnError(int errcode, const char* errstr);
+    bool Relayed() const { return relay_ != NULL; }
 
   private:
     uint32_t        id_;
-    IPAddress       local_addr_;
-    IPAddress       peer_addr_;
+    SockAddr        local_addr_;
+    SockAddr        peer_addr_;
+    bool            quickack_;
 
     OnClosedCallback  creator_notification_cb_;
     TcpCallbacksPtr   tcp_evt_cbs_;
+    TcpRelay*         relay_;
+    std::vector<const Message*> rx_views_;
 };
 
 typedef shared_ptr<TcpConnection>          TcpConnectionPtr;
 typedef map<int/*fd*/, TcpConnectionPtr>   FdTcpConnMap;
 
+/// Connections indexed by their fd. Descriptors are small and reused lowest
+/// first, so a vector gives O(1) lookups without a map node per connection.
+class TcpConnectionTable
+{
+  public:
+    TcpConnectionTable() : count_(0) { }
+
+    TcpConnectionPtr Find(int fd) const {
+        return (fd >= 0 && (size_t)fd < slots_.size()) ? slots_[fd] : nullptr;
+    }
+    bool Insert(int fd, const TcpConnectionPtr& conn);
+    /// The connection is released only after it has left the table
+    void Erase(int fd);
+    void Clear();
+    size_t Size() const { return count_; }
+
+    template <typename Func>
+    void ForEach(Func func) const {
+        for (size_t fd = 0; fd < slots_.size(); fd++) {
+            if (slots_[fd]) func(slots_[fd].get());
+        }
+    }
+
+  private:
+    std::vector<TcpConnectionPtr> slots_;
+    size_t                        count_;
+};
+
+/// An explicit set of connections for fan-out. Connections must be removed
+/// by the owner before they are destroyed (e.g. from on_closed_cb).
+class ConnectionGroup
+{
+  public:
+    ConnectionGroup(MessageType msg_type = MessageType::BINARY) : msg_type_(msg_type) { }
+
+    void Add(TcpConnection* conn) { conns_.insert(conn); }
+    void Remove(TcpConnection* conn) { conns_.erase(conn); }
+    bool Contains(TcpConnection* conn) const { return conns_.find(conn) != conns_.end(); }
+    size_t Size() const { return conns_.size(); }
+    void Clear() { conns_.clear(); }
+    void SetFraming(const Framing& framing) { msg_type_ = MessageType::CUSTOM; framing_ = framing; }
+
+    size_t Broadcast(const Message& msg);
+    size_t Broadcast(const char* data, uint32_t len);
+    size_t Broadcast(const MessagePtr& msg);
+
+  private:
+    MessageType             msg_type_;
+    Framing                 framing_;
+    std::set<TcpConnection*> conns_;
+};
+
 }  // namespace evt_loop
 
 #endif  // _TCP_CONNECTION_H
@@ -0,0 +1,70 @@
+#ifndef _TCP_RELAY_H
+#define _TCP_RELAY_H
+
+#include <functional>
+#include "tcp_connection.h"
+#include "timer_handler.h"
+
+namespace evt_loop {
+
+class TcpRelay;
+
+typedef std::function<void (TcpRelay*) >    OnRelayClosedCallback;
+
+/// Pairs two connections and forwards raw bytes between them with splice(2)
+/// through a kernel pipe per direction, bypassing the message framers.
+/// When a destination can not keep up, reading on its source is paused until
+/// the pipe has been drained.
+/// A relay ending on its own (EOF both ways, an error) is torn down on the
+/// next pass of the loop, never from inside the handler of one of its
+/// connections: closed_cb runs then, without one both connections are
+/// disconnected.
+class TcpRelay
+{
+    public:
+    TcpRelay(TcpConnection* conn_a, TcpConnection* conn_b, const OnRelayClosedCallback& closed_cb = nullptr);
+    ~TcpRelay();
+
+    bool Start();
+    /// Hands both connections back to message framing, bytes still in the
+    /// pipes are queued to their destinations first
+    void Stop();
+    bool IsRunning() const { return running_; }
+
+    uint64_t ForwardedBytesAToB() const { return channels_[0].forwarded; }
+    uint64_t ForwardedBytesBToA() const { return channels_[1].forwarded; }
+
+    void OnEvents(TcpConnection* conn, uint32_t events);
+    void OnConnectionDestroyed(TcpConnection* conn);
+
+    private:
+    struct Channel
+    {
+        TcpConnection*  src;
+        TcpConnection*  dst;
+        int             pipe_fds[2];
+        size_t          capacity;   // pipe size
+        size_t          buffered;   // bytes sitting in the pipe
+        bool            eof;        // source has shut down its writing side
+        bool            shutdown;   // eof has been propagated to destination
+        uint64_t        forwarded;
+    };
+
+    bool OpenChannel(Channel& ch);
+    void CloseChannel(Channel& ch);
+    int  Pump(Channel& ch);
+    int  Drain(Channel& ch);
+    void Close();
+    void OnCloseTimer(PeriodicTimer* timer);
+
+    private:
+    Channel                 channels_[2];
+    bool                    running_;
+    bool                    closing_;       // the teardown waits for close_timer_
+    PeriodicTimer           close_timer_;
+    OnRelayClosedCallback   closed_cb_;
+};
+
+}  // namespace evt_loop
+
+#endif  // _TCP_RELAY_H
@@ -2,16 +2,59 @@
 #define _TCP_SERVER_H
 
 #include "tcp_connection.h"
+#include "timer_handler.h"
+#include "socket_options.h"
 
 namespace evt_loop {
 
 class TcpServer: public IOEvent
 {
     public:
+    /// host is an IPv4 or IPv6 address, "unix:/path" or "unix:@name" (the
+    /// port is ignored then); a socket file is removed again on destruction
     TcpServer(const char *host, uint16_t port, MessageType msg_type = MessageType::BINARY, TcpCallbacksPtr tcp_evt_cbs = nullptr);
+    /// Serves an already listening socket, e.g. one handed over by the
+    /// process this one replaces (see handover.h)
+    TcpServer(int listen_fd, MessageType msg_type = MessageType::BINARY, TcpCallbacksPtr tcp_evt_cbs = nullptr);
     ~TcpServer();
     void SetTcpCallbacks(const TcpCallbacksPtr& tcp_evt_cbs);
+    /// Frames the connections accepted from now on with a user Framer
+    void SetFraming(const Framing& framing) { msg_type_ = MessageType::CUSTOM; framing_ = framing; }
+    /// Tunes the listening socket, the connections accepted from now on
+    /// inherit it, e.g. SetSocketOptions(SocketOptions::LowLatency())
+    void SetSocketOptions(const SocketOptions& opts);
+    /// Length of the queue of pending connections, SOMAXCONN by default
+    /// (further capped by net.core.somaxconn)
+    void SetBacklog(int backlog);
+    /// Connections accepted per readiness event at most, the rest are taken
+    /// in the next loop iteration so that other events are not starved
+    void SetAcceptBatch(uint32_t batch) { accept_batch_ = batch > 0 ? batch : 1; }
+    /// Accepting pauses while this many connections are open and resumes as
+    /// they close, further clients wait in the backlog. 0 means unlimited.
+    void SetMaxConnections(size_t max_conns);
+    /// Clients accepted only to be closed because the process ran out of fds
+    uint64_t RejectedCount() const { return rejected_; }
     TcpConnectionPtr GetConnectionByFD(int fd);
+    size_t ConnectionCount() const { return conn_table_.Size(); }
+    template <typename Func>
+    void ForEachConnection(Func func) const { conn_table_.ForEach(func); }
+
+    /// Closes this process' copy of the listening socket, the connections
+    /// stay. Clients queued on a socket shared with another process are
+    /// accepted there.
+    void StopAccepting();
+    bool Accepting() const { return fd_ >= 0; }
+    /// Takes an idle connection out of the server without closing its socket,
+    /// see TcpConnection::Detach(). Returns the fd or -1.
+    int DetachConnection(int fd, string& pending, size_t max_pending = 0);
+    /// Serves a connected socket as if it was accepted, pending bytes are
+    /// framed before anything read from it
+    TcpConnectionPtr AdoptConnection(int fd, const string& pending = string());
+
+    /// Sends one message to every connection, framed once and shared by all
+    size_t Broadcast(const Message& msg);
+    size_t Broadcast(const char* data, uint32_t len);
+    size_t Broadcast(const MessagePtr& msg);
 
     protected:
     void OnError(int errcode, const char* errstr);
@@ -21,13 +64,28 @@ class TcpServer: public IOEvent
     void Destory();
 
     void OnEvents(uint32_t events);
-    void OnNewClient(int fd, const IPAddress& peer_addr);
+    TcpConnectionPtr OnNewClient(int fd, const SockAddr& peer_addr);
     void OnConnectionClosed(TcpConnection* conn);
+    void OnAcceptError(int errcode);
+    void OnAcceptTimer(PeriodicTimer* timer);
+    bool AtCapacity() const { return max_conns_ > 0 && conn_table_.Size() >= max_conns_; }
+    void PauseAccept();
+    void ResumeAccept();
 
     private:
     IPAddress       server_addr_;
+    SockAddr        listen_addr_;   // the local address of every accepted connection
+    SocketOptions   sock_opts_;
     MessageType     msg_type_;
-    FdTcpConnMap    conn_map_;
+    Framing         framing_;
+    TcpConnectionTable conn_table_;
+    int             backlog_;
+    uint32_t        accept_batch_;
+    size_t          max_conns_;
+    bool            accept_paused_;
+    PeriodicTimer   accept_timer_;  // resumes accepting after running out of fds
+    int             reserve_fd_;    // given up to accept and close a client when out of fds
+    uint64_t        rejected_;
     TcpCallbacksPtr tcp_evt_cbs_;
 };
 
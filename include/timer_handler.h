@@ -31,6 +31,7 @@ class PeriodicTimerEvent : public TimerEvent {
   PeriodicTimerEvent(const TimeVal& inter);
 
   void SetInterval(const TimeVal& inter) { interval_ = inter; }
+  void SetIntervalMs(uint32_t ms) { interval_ = TimeVal(ms / 1000, (ms % 1000) * 1000); }
   const TimeVal& GetInterval() const { return interval_; }
 
   void Start();
@@ -0,0 +1,218 @@
+#ifndef _TLV_H
+#define _TLV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+namespace evt_loop {
+
+/// TLV wire format: every record is a packed { uint16 tag, uint32 length }
+/// header followed by length bytes of value. Like BinaryMessage::HDR the
+/// integers are in host byte order. A value may itself hold TLV records.
+#pragma pack(1)
+struct TlvHeader {
+  uint16_t  tag;
+  uint32_t  length;   // length of the value, the header excluded
+};
+#pragma pack()
+
+/// A non-owning view of bytes inside a received message
+struct TlvBytes {
+  TlvBytes(const char* d = NULL, uint32_t s = 0) : data(d), size(s) { }
+  std::string ToString() const { return std::string(data, size); }
+
+  const char* data;
+  uint32_t    size;
+};
+
+/// Walks the TLV records of a buffer without copying or allocating
+class TlvView {
+ public:
+  class Iterator {
+   public:
+    Iterator(const char* pos, const char* end) : pos_(pos), end_(end) { }
+    bool Valid() const {
+      return pos_ + sizeof(TlvHeader) <= end_ && Length() <= (size_t)(end_ - pos_ - sizeof(TlvHeader));
+    }
+    uint16_t Tag() const          { TlvHeader hdr; memcpy(&hdr, pos_, sizeof(hdr)); return hdr.tag; }
+    uint32_t Length() const       { TlvHeader hdr; memcpy(&hdr, pos_, sizeof(hdr)); return hdr.length; }
+    TlvBytes Value() const        { return TlvBytes(pos_ + sizeof(TlvHeader), Length()); }
+    void Next()                   { pos_ += sizeof(TlvHeader) + Length(); }
+
+   private:
+    const char* pos_;
+    const char* end_;
+  };
+
+ public:
+  TlvView(const char* data = NULL, uint32_t size = 0) : data_(data), size_(size) { }
+  TlvView(const TlvBytes& bytes) : data_(bytes.data), size_(bytes.size) { }
+
+  Iterator Begin() const { return Iterator(data_, data_ + size_); }
+  bool Empty() const { return size_ == 0; }
+
+  /// Returns the value of the first record with the tag
+  bool Find(uint16_t tag, TlvBytes& value) const {
+    for (Iterator it = Begin(); it.Valid(); it.Next()) {
+      if (it.Tag() == tag) {
+        value = it.Value();
+        return true;
+      }
+    }
+    return false;
+  }
+  /// True when the records cover the buffer exactly
+  bool WellFormed() const {
+    Iterator it = Begin();
+    const char* pos = data_;
+    for (; it.Valid(); it.Next()) {
+      pos += sizeof(TlvHeader) + it.Length();
+    }
+    return pos == data_ + size_;
+  }
+
+ private:
+  const char* data_;
+  uint32_t    size_;
+};
+
+/// Decodes a field value into T. Arithmetic types must match their size
+/// exactly, TlvBytes and TlvView are views into the message.
+template <typename T>
+struct TlvDecoder {
+  static bool Decode(const TlvBytes& raw, T& out) {
+    if (raw.size != sizeof(T)) return false;
+    memcpy(&out, raw.data, sizeof(T));
+    return true;
+  }
+  static bool Check(const TlvBytes& raw) { return raw.size == sizeof(T); }
+};
+template <>
+struct TlvDecoder<TlvBytes> {
+  static bool Decode(const TlvBytes& raw, TlvBytes& out) { out = raw; return true; }
+  static bool Check(const TlvBytes& raw) { return true; }
+};
+template <>
+struct TlvDecoder<TlvView> {
+  static bool Decode(const TlvBytes& raw, TlvView& out) { out = TlvView(raw); return true; }
+  static bool Check(const TlvBytes& raw) { return TlvView(raw).WellFormed(); }
+};
+
+/// Binds a tag to the type of its value in a schema
+template <uint16_t Tag, typename T>
+struct TlvField {
+  static const uint16_t tag = Tag;
+  typedef T type;
+};
+
+/// Compile-time tag -> type lookup over a list of TlvFields
+template <uint16_t Tag, typename... Fields>
+struct TlvFieldType;
+
+template <uint16_t Tag, typename Field, typename... Rest>
+struct TlvFieldType<Tag, Field, Rest...> {
+  typedef typename TlvFieldType<Tag, Rest...>::type type;
+};
+template <uint16_t Tag, typename T, typename... Rest>
+struct TlvFieldType<Tag, TlvField<Tag, T>, Rest...> {
+  typedef T type;
+};
+template <uint16_t Tag>
+struct TlvFieldType<Tag> {
+  // Reaching the end of the list means the tag is not part of the schema
+};
+
+template <typename... Fields>
+struct TlvSchemaCheck;
+
+template <typename Field, typename... Rest>
+struct TlvSchemaCheck<Field, Rest...> {
+  static bool Check(uint16_t tag, const TlvBytes& raw) {
+    if (tag == Field::tag) return TlvDecoder<typename Field::type>::Check(raw);
+    return TlvSchemaCheck<Rest...>::Check(tag, raw);
+  }
+};
+template <>
+struct TlvSchemaCheck<> {
+  static bool Check(uint16_t tag, const TlvBytes& raw) { return true; }  // unknown tags are skipped
+};
+
+/// A record decoded lazily against a compile-time schema, e.g.
+///   typedef TlvRecord< TlvField<1, uint32_t>, TlvField<2, TlvBytes> > Telemetry;
+///   Telemetry rec(msg->Value());
+///   uint32_t device_id;
+///   if (rec.Get<1>(device_id)) ...
+/// Fields are located when they are asked for and point into the message.
+template <typename... Fields>
+class TlvRecord {
+ public:
+  explicit TlvRecord(const TlvView& view) : view_(view) { }
+
+  template <uint16_t Tag>
+  bool Get(typename TlvFieldType<Tag, Fields...>::type& out) const {
+    TlvBytes raw;
+    if (!view_.Find(Tag, raw)) return false;
+    return TlvDecoder<typename TlvFieldType<Tag, Fields...>::type>::Decode(raw, out);
+  }
+  template <uint16_t Tag>
+  bool Has() const {
+    TlvBytes raw;
+    return view_.Find(Tag, raw);
+  }
+  /// Checks the record layout first, then the size of every known field
+  bool Validate() const {
+    if (!view_.WellFormed()) return false;
+    for (TlvView::Iterator it = view_.Begin(); it.Valid(); it.Next()) {
+      if (!TlvSchemaCheck<Fields...>::Check(it.Tag(), it.Value())) return false;
+    }
+    return true;
+  }
+  const TlvView& View() const { return view_; }
+
+ private:
+  TlvView view_;
+};
+
+/// Encodes TLV records into a buffer, nested records are opened with Begin()
+/// and their length is patched by End()
+class TlvWriter {
+ public:
+  TlvWriter(std::string& buffer) : buffer_(buffer) { }
+
+  template <typename T>
+  TlvWriter& Put(uint16_t tag, const T& value) {
+    return PutBytes(tag, (const char*)&value, sizeof(value));
+  }
+  TlvWriter& PutBytes(uint16_t tag, const char* data, uint32_t length) {
+    TlvHeader hdr;
+    hdr.tag = tag;
+    hdr.length = length;
+    buffer_.append((const char*)&hdr, sizeof(hdr));
+    buffer_.append(data, length);
+    return *this;
+  }
+  TlvWriter& PutString(uint16_t tag, const std::string& value) {
+    return PutBytes(tag, value.data(), value.size());
+  }
+  size_t Begin(uint16_t tag) {
+    size_t offset = buffer_.size();
+    TlvHeader hdr;
+    hdr.tag = tag;
+    hdr.length = 0;
+    buffer_.append((const char*)&hdr, sizeof(hdr));
+    return offset;
+  }
+  void End(size_t offset) {
+    uint32_t length = buffer_.size() - offset - sizeof(TlvHeader);
+    memcpy(&buffer_[offset + offsetof(TlvHeader, length)], &length, sizeof(length));
+  }
+
+ private:
+  std::string& buffer_;
+};
+
+}  // namespace evt_loop
+
+#endif  // _TLV_H
@@ -0,0 +1,90 @@
+#ifndef _TX_SCHEDULER_H
+#define _TX_SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "message.h"
+
+namespace evt_loop {
+
+/// Outbound lanes of a connection, the lower the more urgent
+enum TxLane {
+  TX_LANE_CONTROL,    // heartbeats, cancels, acks
+  TX_LANE_HIGH,
+  TX_LANE_NORMAL,     // Send() without a lane
+  TX_LANE_BULK,
+  TX_LANE_COUNT,
+};
+
+/// Orders outbound messages of one connection. Every lane is a FIFO; a
+/// deficit round robin weighted per lane moves messages at their boundaries
+/// onto a short wire queue, which is all the socket writer sees. The wire
+/// queue is topped up to a small budget only, so a message queued on an
+/// urgent lane waits behind at most that budget and not the whole backlog.
+///
+/// With _BINARY_MSG_EXTEND_PACKAGING, binary messages larger than the
+/// fragment size are cut into FLAG_FRAGMENT frames, letting other lanes in
+/// between the pieces of a bulk message. One message is fragmented at a time
+/// per connection, the receiving BufferIOEvent reassembles it.
+class TxScheduler {
+ public:
+  struct Frame {
+    MessagePtr  data;   // what goes on the wire
+    MessagePtr  done;   // reported to OnSent once data is written, NULL for non-final fragments
+  };
+
+ public:
+  TxScheduler();
+
+  void SetWeight(TxLane lane, uint32_t weight) { lanes_[lane].weight = weight > 0 ? weight : 1; }
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+  /// Payload bytes per fragment, 0 (default) disables fragmentation
+  void SetFragmentSize(size_t size) { frag_size_ = size; }
+#endif
+
+  /// Without report, OnSent is not raised for the message
+  void Push(const MessagePtr& msg, TxLane lane, bool report = true);
+  /// Queues a frame behind the wire queue, bypassing the lanes
+  void PushWire(const MessagePtr& msg, bool report = true);
+  void Schedule();
+
+  bool Empty() const { return wire_.empty() && queued_msgs_ == 0; }
+  /// Bytes waiting in the lanes and on the wire queue, including the written
+  /// part of the wire queue's first frame
+  size_t QueuedBytes() const { return lane_bytes_ + wire_bytes_; }
+  void Clear();
+
+  size_t WireSize() const { return wire_.size(); }
+  Frame& WireAt(size_t i) { return wire_[i]; }
+  void PopWire();
+
+ private:
+  struct Lane {
+    Lane() : weight(1), deficit(0), credited(false), frag_offset(0) { }
+
+    RingQueue<Frame> mq;    // done is NULL for messages not reported
+    uint32_t  weight;
+    size_t    deficit;      // bytes the lane may still send in this round
+    bool      credited;     // the quantum of this round has been granted
+    size_t    frag_offset;  // payload bytes of the head message already fragmented
+  };
+
+  bool NeedsFragment(const MessagePtr& msg) const;
+  size_t NextFrameSize(const Lane& lane) const;
+  void EmitNext(int index);
+  void Advance();
+
+ private:
+  Lane              lanes_[TX_LANE_COUNT];
+  RingQueue<Frame>  wire_;
+  size_t            wire_bytes_;
+  size_t            lane_bytes_;
+  size_t            queued_msgs_;
+  int               cur_lane_;
+  size_t            frag_size_;
+  int               frag_lane_;   // lane whose head message is being fragmented, or -1
+};
+
+}  // namespace evt_loop
+
+#endif  // _TX_SCHEDULER_H
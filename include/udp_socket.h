@@ -0,0 +1,128 @@
+#ifndef _UDP_SOCKET_H
+#define _UDP_SOCKET_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include "fd_handler.h"
+#include "utils.h"
+
+using std::string;
+
+namespace evt_loop {
+
+class UdpSocket;
+
+/// A received datagram. data points into the receive batch of the socket and
+/// is valid during the callback only.
+struct Datagram
+{
+    const char* data;
+    uint32_t    size;
+    SockAddr    peer;
+};
+
+typedef std::function<void (UdpSocket*, const Datagram*, size_t) >  OnDatagramsCallback;
+typedef std::function<void (int, const char*) >                     OnUdpErrorCallback;
+
+struct UdpCallbacks
+{
+    OnDatagramsCallback on_datagrams_cb;    // the datagrams of one recvmmsg() call
+    OnUdpErrorCallback  on_error_cb;
+};
+typedef std::shared_ptr<UdpCallbacks>   UdpCallbacksPtr;
+
+/// A UDP socket on the loop. Datagrams are received with recvmmsg() into
+/// buffers allocated once per socket and handed to the callback a batch at a
+/// time. Sends are queued and go out with sendmmsg() once the callback has
+/// returned, on Flush(), or else in the next loop iteration.
+class UdpSocket : public IOEvent
+{
+    public:
+    /// A SERVER binds to host:port, a CLIENT connects to it. host is an IPv4
+    /// or IPv6 address, "localhost" or "any".
+    enum Role { SERVER, CLIENT };
+
+    UdpSocket(const char* host, uint16_t port, Role role = SERVER, UdpCallbacksPtr udp_evt_cbs = nullptr);
+    ~UdpSocket();
+
+    void SetUdpCallbacks(const UdpCallbacksPtr& udp_evt_cbs) { udp_evt_cbs_ = udp_evt_cbs; }
+    /// Datagrams per recvmmsg()/sendmmsg() call and the size of a receive
+    /// buffer, longer datagrams are truncated
+    void SetBatch(uint32_t batch_size, uint32_t max_datagram_size);
+    /// Lets the kernel coalesce the datagrams of a flow on receipt (UDP_GRO),
+    /// they are split up again before the callback. false without support.
+    bool EnableGro(bool enable);
+    /// Consecutive datagrams of this size to one peer are handed to the
+    /// kernel as one buffer it segments (UDP_SEGMENT), 0 turns it off
+    void SetGsoSize(uint16_t gso_size) { gso_size_ = gso_size; }
+    /// Datagrams queued at most, further sends are dropped
+    void SetMaxPending(size_t max_pending) { max_pending_ = max_pending; }
+
+    /// Queues a copy of the datagram, false if it was dropped
+    bool SendTo(const char* data, uint32_t len, const SockAddr& peer);
+    /// To the peer of a CLIENT
+    bool Send(const char* data, uint32_t len) { return SendTo(data, len, SockAddr()); }
+    bool Send(const string& data) { return Send(data.data(), data.size()); }
+    /// Sends what is queued now, returns the number of datagrams sent
+    size_t Flush();
+
+    const SockAddr& LocalAddr() const { return local_addr_; }
+    size_t PendingCount() const { return tx_queue_.size() - tx_head_; }
+    uint64_t ReceivedCount() const { return rx_count_; }
+    uint64_t SentCount() const { return tx_count_; }
+    uint64_t DroppedCount() const { return tx_dropped_; }
+
+    protected:
+    void OnError(int errcode, const char* errstr);
+
+    private:
+    bool Open(const IPAddress& addr, Role role);
+    void Close();
+    void OnEvents(uint32_t events);
+    void Receive();
+    size_t Deliver(size_t count);
+    void PrepareRx();
+    int  PackTx(size_t first, struct mmsghdr& msg, struct iovec* iovs, char* control);
+
+    private:
+    struct TxEntry
+    {
+        uint32_t    offset;     // in tx_buffer_
+        uint32_t    size;
+        SockAddr    peer;       // AF_UNSPEC for the connected peer
+    };
+
+    uint32_t                    batch_size_;
+    uint32_t                    max_datagram_size_;
+    bool                        gro_;
+    uint16_t                    gso_size_;
+    size_t                      max_pending_;
+    SockAddr                    local_addr_;
+
+    std::vector<char>           rx_buffer_;
+    std::vector<struct mmsghdr> rx_msgs_;
+    std::vector<struct iovec>   rx_iovs_;
+    std::vector<SockAddr>       rx_peers_;
+    std::vector<uint64_t>       rx_control_;    // cmsg buffers, 8 byte aligned
+    std::vector<Datagram>       rx_dgrams_;
+
+    string                      tx_buffer_;
+    std::vector<TxEntry>        tx_queue_;
+    size_t                      tx_head_;       // first entry not sent yet
+    std::vector<struct mmsghdr> tx_msgs_;
+    std::vector<struct iovec>   tx_iovs_;
+    std::vector<uint64_t>       tx_control_;
+    std::vector<uint32_t>       tx_counts_;     // entries packed into each message
+
+    uint64_t                    rx_count_;
+    uint64_t                    tx_count_;
+    uint64_t                    tx_dropped_;
+    UdpCallbacksPtr             udp_evt_cbs_;
+};
+
+}  // namespace evt_loop
+
+#endif  // _UDP_SOCKET_H
@@ -2,11 +2,13 @@
 #define _UTILS_H
 
 #include <stdint.h>
+#include <string.h>
 #include <time.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/un.h>
 #include <string>
 
 using std::string;
@@ -51,7 +53,38 @@ struct IPAddress
   }
 };
 
+/// Unix domain sockets are named "unix:/path" in IPAddress::ip_, or
+/// "unix:@name" in the abstract namespace; the port is 0 for them. IPv6
+/// literals may be given with or without brackets.
+#define UNIX_ADDR_PREFIX  "unix:"
+
 void SocketAddrToIPAddress(const struct sockaddr_in& sock_addr, IPAddress& ip_addr);
+/// Any family, len is the length returned by accept()/getsockname()
+void SocketAddrToIPAddress(const struct sockaddr* sock_addr, socklen_t len, IPAddress& ip_addr);
+/// Fills the socket address of ip_addr, false if it is not a valid address
+bool IPAddressToSocketAddr(const IPAddress& ip_addr, struct sockaddr_storage& sock_addr, socklen_t& len);
+
+/// A socket address in its binary form, 28 bytes for either IP family. Kept
+/// per connection instead of IPAddress, whose text form is only built when
+/// it is asked for. Only the family is kept of a unix domain address, whose
+/// path does not fit; it is read from the socket when needed.
+struct SockAddr
+{
+  union {
+    struct sockaddr     sa;
+    struct sockaddr_in  v4;
+    struct sockaddr_in6 v6;
+  };
+
+  SockAddr() { memset(&v6, 0, sizeof(v6)); }   // the largest member
+  SockAddr(const struct sockaddr* addr, socklen_t len);
+
+  sa_family_t Family() const { return sa.sa_family; }
+  socklen_t Length() const;
+  uint16_t Port() const;
+  IPAddress ToIPAddress() const;
+  string ToString() const { return ToIPAddress().ToString(); }
+};
 
 }  // namespace evt_loop
 
@@ -1,4 +1,5 @@
 #include "hiredis_adapter.h"
+#include "logger.h"
 
 namespace hiredis {
 
@@ -50,6 +51,8 @@ static void __RedisDisconnectCallback(const redisAsyncContext *ctx, int status)
 RedisAsyncClient::RedisAsyncClient(const char* host, uint16_t port, bool auto_reconnect, RedisCallbacksPtr redis_cbs) :
   redis_ctx_(NULL), auto_reconnect_(auto_reconnect),
   reconnect_timer_(std::bind(&RedisAsyncClient::OnReconnectTimer, this, std::placeholders::_1)),
+  connected_(false), connect_timeout_ms_(DEFAULT_CONNECT_TIMEOUT_MS),
+  connect_timer_(std::bind(&RedisAsyncClient::OnConnectTimer, this, std::placeholders::_1)),
   redis_cbs_(redis_cbs)
 {
   server_addr_.port_ = port;
@@ -60,12 +63,6 @@ RedisAsyncClient::RedisAsyncClient(const char* host, uint16_t port, bool auto_re
   } else {
     server_addr_.ip_ = host;
   }
-  if (auto_reconnect_) {
-    timeval tv;
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
-    reconnect_timer_.SetInterval(tv);
-  }
 
   Connect();
   SendCommand("ping");  // trigger callback OnRedisConnect
@@ -98,8 +95,16 @@ void RedisAsyncClient::Disconnect()
 void RedisAsyncClient::Reconnect()
 {
   //Disconnect();
-  if (!reconnect_timer_.IsRunning())
-    reconnect_timer_.Start();
+  if (reconnect_timer_.IsRunning())
+    return;
+  uint32_t delay_ms = 0;
+  if (!backoff_.NextDelay(delay_ms)) {
+    OnError(ECONNABORTED, "reconnect attempts exhausted");
+    return;
+  }
+  EL_LOG_INFO("[RedisAsyncClient::Reconnect] attempt %u in %u ms", backoff_.Stats().consecutive_failures, delay_ms);
+  reconnect_timer_.SetIntervalMs(delay_ms);
+  reconnect_timer_.Start();
 }
 
 /*
@@ -131,13 +136,42 @@ void RedisAsyncClient::SetRedisCallbacks(const RedisCallbacksPtr& redis_cbs)
 
 bool RedisAsyncClient::Connect_()
 {
-  redisAsyncContext* ctx = redisAsyncConnect(server_addr_.ip_.c_str(), server_addr_.port_);
+  /// hiredis takes socket paths, but no abstract names
+  redisAsyncContext* ctx = NULL;
+  const size_t prefix_len = strlen(UNIX_ADDR_PREFIX);
+  if (server_addr_.ip_.compare(0, prefix_len, UNIX_ADDR_PREFIX) == 0) {
+    ctx = redisAsyncConnectUnix(server_addr_.ip_.c_str() + prefix_len);
+  } else {
+    ctx = redisAsyncConnect(server_addr_.ip_.c_str(), server_addr_.port_);
+  }
   if (ctx && ctx->err) {
-    printf("[RedisAsyncClient::Connect_] Error: %s\n", ctx->errstr);
+    EL_LOG_ERROR("[RedisAsyncClient::Connect_] Error: %s", ctx->errstr);
     redisAsyncFree(ctx);
     return false;
   }
-  return SetContext(ctx) == REDIS_OK;
+  if (SetContext(ctx) != REDIS_OK) {
+    return false;
+  }
+  connected_ = false;
+  StartConnectTimer();
+  return true;
+}
+
+void RedisAsyncClient::SetConnectTimeout(uint32_t timeout_ms)
+{
+  connect_timeout_ms_ = timeout_ms;
+  if (redis_ctx_ && !connected_) {
+    StartConnectTimer();
+  }
+}
+
+void RedisAsyncClient::StartConnectTimer()
+{
+  if (connect_timer_.IsRunning()) connect_timer_.Stop();
+  if (connect_timeout_ms_ > 0) {
+    connect_timer_.SetIntervalMs(connect_timeout_ms_);
+    connect_timer_.Start();
+  }
 }
 
 int RedisAsyncClient::SetContext(redisAsyncContext * ctx)
@@ -178,6 +212,11 @@ void RedisAsyncClient::SendTempBuffer()
 void RedisAsyncClient::OnEvents(uint32_t events)
 {
   //printf("[RedisAsyncClient::OnEvents] events: %d\n", events);
+  /// Timers run before the events of a pass, an event collected for a
+  /// context OnConnectTimer() has freed in the same pass is stale
+  if (redis_ctx_ == NULL) {
+    return;
+  }
   if (events & IOEvent::WRITE) {
     redisAsyncHandleWrite(redis_ctx_); 
   }
@@ -192,7 +231,7 @@ void RedisAsyncClient::OnEvents(uint32_t events)
 void RedisAsyncClient::OnRedisReply(const redisAsyncContext* ctx, redisReply* reply)
 {
   /*
-  printf("[RedisAsyncClient::OnRedisReply] received reply, fd: %d\n"
+  printf("[RedisAsyncClient::OnRedisReply] received reply, fd: %d"
       " reply: { type: %d, integer: %d, len: %d, str: %s, elements: %d, element list: %x }\n",
       ctx->c.fd, reply->type, reply->integer, reply->len, reply->str, reply->elements, reply->element);
   */
@@ -201,17 +240,25 @@ void RedisAsyncClient::OnRedisReply(const redisAsyncContext* ctx, redisReply* re
 }
 void RedisAsyncClient::OnRedisConnect(const redisAsyncContext* ctx, int status)
 {
-  printf("[RedisAsyncClient::OnRedisConnect] connection fd: %d, status: %d\n", ctx->c.fd, status);
+  EL_LOG_INFO("[RedisAsyncClient::OnRedisConnect] connection fd: %d, status: %d", ctx->c.fd, status);
+  if (connect_timer_.IsRunning()) connect_timer_.Stop();
   if (status == 0) {
+    connected_ = true;
+    backoff_.OnConnected();
     //SendTempBuffer();
     if (redis_cbs_) redis_cbs_->on_connected_cb(this);
   } else {
+    /// hiredis frees the context once this returns
+    SetFD(-1);
+    redis_ctx_ = NULL;
     Reconnect();
   }
 }
 void RedisAsyncClient::OnRedisDisconnect(const redisAsyncContext* ctx, int status)
 {
-  printf("[RedisAsyncClient::OnRedisDisconnect] connection lost, fd: %d, status: %d\n", ctx->c.fd, status);
+  EL_LOG_WARN("[RedisAsyncClient::OnRedisDisconnect] connection lost, fd: %d, status: %d", ctx->c.fd, status);
+  connected_ = false;
+  backoff_.OnDisconnected();
   if (redis_cbs_) redis_cbs_->on_closed_cb(this);
   if (auto_reconnect_) {
     Reconnect();
@@ -219,20 +266,37 @@ void RedisAsyncClient::OnRedisDisconnect(const redisAsyncContext* ctx, int statu
 }
 void RedisAsyncClient::OnError(int errcode, const char* errstr)
 {
-  printf("[RedisAsyncClient::OnError] error code: %d, error string: %s\n", errcode, errstr);
+  EL_LOG_ERROR("[RedisAsyncClient::OnError] error code: %d, error string: %s", errcode, errstr);
   if (redis_cbs_) redis_cbs_->on_error_cb(errcode, errstr);
 }
 
+/// The connect has not completed in time, the context is given up. hiredis
+/// calls no connect or disconnect callback for a context freed before it
+/// connected, and OnEvents() drops an event already collected for it.
+void RedisAsyncClient::OnConnectTimer(PeriodicTimer* timer)
+{
+  timer->Stop();
+  if (connected_ || redis_ctx_ == NULL) {
+    return;
+  }
+  redisAsyncContext* ctx = redis_ctx_;
+  SetFD(-1);
+  redis_ctx_ = NULL;
+  redisAsyncFree(ctx);
+  OnError(ETIMEDOUT, "connect timed out");
+  if (auto_reconnect_) {
+    Reconnect();
+  }
+}
+
 void RedisAsyncClient::OnReconnectTimer(PeriodicTimer* timer)
 {
+  timer->Stop();
   if (redis_ctx_ == NULL || redis_ctx_->err != REDIS_OK) {  // if the connection is not created, then reconnect
-    bool success = Connect_();
-    if (success)
-      timer->Stop();
-    else
-      printf("[RedisAsyncClient::ReconnectTimer::OnTimer] Reconnect failed, retry %u seconds later...\n", timer->GetInterval().Seconds());
-  } else {
-    timer->Stop();
+    if (!Connect_()) {
+      EL_LOG_WARN("[RedisAsyncClient::OnReconnectTimer] Reconnect failed");
+      Reconnect();
+    }
   }
 }
 
@@ -25,8 +25,15 @@ class RedisAsyncClient : public IOEvent {
   ~RedisAsyncClient();
   bool Init();
 
+  /// hiredis connects without blocking, a connect taking longer than the
+  /// timeout is given up (0 waits for the kernel)
   bool Connect();
   void Disconnect();
+  /// A connect under way is given this long from now, as by TcpClient
+  void SetConnectTimeout(uint32_t timeout_ms);
+  /// Spacing of auto reconnect attempts, see TcpClient::SetReconnectPolicy()
+  void SetReconnectPolicy(const ReconnectPolicy& policy) { backoff_.SetPolicy(policy); }
+  const ReconnectStats& GetReconnectStats() const { return backoff_.Stats(); }
   void SetRedisCallbacks(const RedisCallbacksPtr& redis_cbs);
   redisAsyncContext* RedisContext() { return redis_ctx_; }
 
@@ -41,18 +48,24 @@ class RedisAsyncClient : public IOEvent {
   int SetContext(redisAsyncContext * ctx);
   bool Connect_();
   void Reconnect();
+  void StartConnectTimer();
   //void SendTempBuffer();
 
   void OnEvents(uint32_t events);
   void OnError(int errcode, const char* errstr);
   void OnReconnectTimer(PeriodicTimer* timer);
+  void OnConnectTimer(PeriodicTimer* timer);
 
   private:
   IPAddress           server_addr_;
   redisAsyncContext*  redis_ctx_;
   bool                auto_reconnect_;
   //list<string>        tmp_sendbuf_list_;
-  PeriodicTimer       reconnect_timer_;
+  PeriodicTimer       reconnect_timer_;     // one shot, rescheduled by backoff_
+  ReconnectBackoff    backoff_;
+  bool                connected_;
+  uint32_t            connect_timeout_ms_;
+  PeriodicTimer       connect_timer_;
 
   RedisCallbacksPtr   redis_cbs_;
 };
@@ -1,9 +1,9 @@
 #ifndef _REDIS_CALLBACKS_H
 #define _REDIS_CALLBACKS_H
 
-#include <stdio.h>
 #include <functional>
 #include <memory>
+#include "logger.h"
 
 namespace hiredis {
 
@@ -34,11 +34,11 @@ struct RedisCallbacks {
     OnErrorCallback     on_error_cb;
 
     private:
-    void EmptyReplyCb(RedisAsyncClient*, const RedisMessage*)           { printf("Empty Redis Reply Callback\n"); }
-    void EmptyCmdSentCb(RedisAsyncClient*, const RedisMessage*)         { printf("Empty Redis Command Sent Callback\n"); }
-    void EmptyConnectedCb(RedisAsyncClient*)                            { printf("Empty Connected Callback\n"); }
-    void EmptyClosedCb(RedisAsyncClient*)                               { printf("Empty Connection Closed Callback\n"); }
-    void EmptyErrorCb(int, const char*)                                 { printf("Empty Connection Error Callback\n"); }
+    void EmptyReplyCb(RedisAsyncClient*, const RedisMessage*)           { EL_LOG_DEBUG("Empty Redis Reply Callback"); }
+    void EmptyCmdSentCb(RedisAsyncClient*, const RedisMessage*)         { EL_LOG_DEBUG("Empty Redis Command Sent Callback"); }
+    void EmptyConnectedCb(RedisAsyncClient*)                            { EL_LOG_DEBUG("Empty Connected Callback"); }
+    void EmptyClosedCb(RedisAsyncClient*)                               { EL_LOG_DEBUG("Empty Connection Closed Callback"); }
+    void EmptyErrorCb(int, const char*)                                 { EL_LOG_DEBUG("Empty Connection Error Callback"); }
 };
 
 typedef std::shared_ptr<RedisCallbacks>           RedisCallbacksPtr;
@@ -0,0 +1,185 @@
+#include "compressor.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#ifdef _ENABLE_LZ4
+#include <lz4.h>
+#endif
+#ifdef _ENABLE_ZSTD
+#include <zstd.h>
+#endif
+
+#define COMPRESSED_PREFIX_SIZE  sizeof(uint32_t)   // original size in front of every block
+#define ZSTD_DEFAULT_LEVEL      3
+#define MAX_DECOMPRESSED_SIZE   (64 * 1024 * 1024)  // when the caller sets no limit
+#define LZ4_MAX_RATIO           255                 // an LZ4 block can not expand more
+
+namespace evt_loop {
+
+CompressionDict::CompressionDict(const std::string& content, int zstd_level) :
+  content_(content), zstd_cdict_(NULL), zstd_ddict_(NULL)
+{
+#ifdef _ENABLE_ZSTD
+  zstd_cdict_ = ZSTD_createCDict(content_.data(), content_.size(), zstd_level > 0 ? zstd_level : ZSTD_DEFAULT_LEVEL);
+  zstd_ddict_ = ZSTD_createDDict(content_.data(), content_.size());
+#endif
+}
+
+CompressionDict::~CompressionDict()
+{
+#ifdef _ENABLE_ZSTD
+  ZSTD_freeCDict((ZSTD_CDict*)zstd_cdict_);
+  ZSTD_freeDDict((ZSTD_DDict*)zstd_ddict_);
+#endif
+}
+
+/// Like the message pools the contexts are per thread and never destroyed
+Compressor& Compressor::Instance()
+{
+  static thread_local Compressor* compressor = new Compressor();
+  return *compressor;
+}
+
+Compressor::Compressor() : zstd_cctx_(NULL), zstd_dctx_(NULL), lz4_state_(NULL)
+{
+#ifdef _ENABLE_ZSTD
+  zstd_cctx_ = ZSTD_createCCtx();
+  zstd_dctx_ = ZSTD_createDCtx();
+#endif
+#ifdef _ENABLE_LZ4
+  lz4_state_ = malloc(LZ4_sizeofState());
+#endif
+}
+
+Compressor::~Compressor()
+{
+#ifdef _ENABLE_ZSTD
+  ZSTD_freeCCtx((ZSTD_CCtx*)zstd_cctx_);
+  ZSTD_freeDCtx((ZSTD_DCtx*)zstd_dctx_);
+#endif
+  free(lz4_state_);
+}
+
+bool Compressor::Supported(CompressionType type)
+{
+  switch (type) {
+#ifdef _ENABLE_LZ4
+    case COMPRESS_LZ4:
+      return true;
+#endif
+#ifdef _ENABLE_ZSTD
+    case COMPRESS_ZSTD:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+bool Compressor::Compress(const CompressionOptions& opts, const char* data, size_t size, std::string& out)
+{
+  if (!Supported(opts.type) || size > UINT32_MAX) return false;
+
+  size_t compressed = 0;
+  switch (opts.type) {
+#ifdef _ENABLE_LZ4
+    case COMPRESS_LZ4: {
+      out.resize(COMPRESSED_PREFIX_SIZE + LZ4_compressBound(size));
+      char* dst = &out[COMPRESSED_PREFIX_SIZE];
+      int capacity = out.size() - COMPRESSED_PREFIX_SIZE;
+      int acceleration = opts.level > 0 ? opts.level : 1;
+      int n = 0;
+      if (opts.dict) {
+        LZ4_stream_t* stream = LZ4_initStream(lz4_state_, LZ4_sizeofState());
+        LZ4_loadDict(stream, opts.dict->content_.data(), opts.dict->content_.size());
+        n = LZ4_compress_fast_continue(stream, data, dst, size, capacity, acceleration);
+      } else {
+        n = LZ4_compress_fast_extState(lz4_state_, data, dst, size, capacity, acceleration);
+      }
+      compressed = n > 0 ? n : 0;
+      break;
+    }
+#endif
+#ifdef _ENABLE_ZSTD
+    case COMPRESS_ZSTD: {
+      out.resize(COMPRESSED_PREFIX_SIZE + ZSTD_compressBound(size));
+      char* dst = &out[COMPRESSED_PREFIX_SIZE];
+      size_t capacity = out.size() - COMPRESSED_PREFIX_SIZE;
+      size_t n = 0;
+      if (opts.dict && opts.dict->zstd_cdict_) {
+        n = ZSTD_compress_usingCDict((ZSTD_CCtx*)zstd_cctx_, dst, capacity, data, size,
+            (const ZSTD_CDict*)opts.dict->zstd_cdict_);
+      } else {
+        n = ZSTD_compressCCtx((ZSTD_CCtx*)zstd_cctx_, dst, capacity, data, size,
+            opts.level > 0 ? opts.level : ZSTD_DEFAULT_LEVEL);
+      }
+      compressed = ZSTD_isError(n) ? 0 : n;
+      break;
+    }
+#endif
+    default:
+      break;
+  }
+  if (compressed == 0 || COMPRESSED_PREFIX_SIZE + compressed >= size) {
+    return false;
+  }
+  uint32_t original_size = size;
+  memcpy(&out[0], &original_size, sizeof(original_size));
+  out.resize(COMPRESSED_PREFIX_SIZE + compressed);
+  return true;
+}
+
+bool Compressor::Decompress(CompressionType type, const CompressionDict* dict,
+    const char* data, size_t size, size_t max_size, std::string& out)
+{
+  if (!Supported(type) || size < COMPRESSED_PREFIX_SIZE) return false;
+
+  uint32_t original_size = 0;
+  memcpy(&original_size, data, sizeof(original_size));
+  data += COMPRESSED_PREFIX_SIZE;
+  size -= COMPRESSED_PREFIX_SIZE;
+  /// The size prefix is untrusted, it is checked before the buffer is allocated
+  if (max_size == 0) max_size = MAX_DECOMPRESSED_SIZE;
+  if (type == COMPRESS_LZ4) max_size = std::min(max_size, size * LZ4_MAX_RATIO);
+  if (original_size > max_size) {
+    EL_LOG_WARN("[Compressor::Decompress] original size %u exceeds the limit %lu", original_size, max_size);
+    return false;
+  }
+  out.resize(original_size);
+
+  size_t decompressed = (size_t)-1;
+  switch (type) {
+#ifdef _ENABLE_LZ4
+    case COMPRESS_LZ4: {
+      int n = 0;
+      if (dict) {
+        n = LZ4_decompress_safe_usingDict(data, &out[0], size, original_size,
+            dict->content_.data(), dict->content_.size());
+      } else {
+        n = LZ4_decompress_safe(data, &out[0], size, original_size);
+      }
+      if (n >= 0) decompressed = n;
+      break;
+    }
+#endif
+#ifdef _ENABLE_ZSTD
+    case COMPRESS_ZSTD: {
+      size_t n = 0;
+      if (dict && dict->zstd_ddict_) {
+        n = ZSTD_decompress_usingDDict((ZSTD_DCtx*)zstd_dctx_, &out[0], original_size, data, size,
+            (const ZSTD_DDict*)dict->zstd_ddict_);
+      } else {
+        n = ZSTD_decompressDCtx((ZSTD_DCtx*)zstd_dctx_, &out[0], original_size, data, size);
+      }
+      if (!ZSTD_isError(n)) decompressed = n;
+      break;
+    }
+#endif
+    default:
+      break;
+  }
+  return decompressed == original_size;
+}
+
+}  // namespace evt_loop
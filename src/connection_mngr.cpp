@@ -1,4 +1,5 @@
 #include "connection_mngr.h"
+#include "logger.h"
 
 namespace evt_loop {
 
@@ -28,10 +29,10 @@ void ConnectionManager::SetupInactivityChecker(uint32_t timeout)
 }
 void ConnectionManager::AddConnection(TcpConnection* conn)
 {
-    printf("[ConnectionManager::AddConnection] cid: %u\n", conn->ID());
+    EL_LOG_DEBUG("[ConnectionManager::AddConnection] cid: %u", conn->ID());
     if (m_client_map.find(conn->ID()) != m_client_map.end())
     {
-        printf("[ConnectionManager::AddConnection] client (cid: %u) is exists, dosn't add again!\n", conn->ID());
+        EL_LOG_WARN("[ConnectionManager::AddConnection] client (cid: %u) is exists, dosn't add again!", conn->ID());
         return;
     }
     ConnectionContextPtr conn_ctx = std::make_shared<ConnectionContext>(conn);
@@ -49,7 +50,7 @@ TcpConnection* ConnectionManager::GetConnection(ClientID cid)
 }
 void ConnectionManager::RemoveConnection(ClientID cid)
 {
-    printf("[ConnectionManager::RemoveConnection] cid: %u\n", cid);
+    EL_LOG_DEBUG("[ConnectionManager::RemoveConnection] cid: %u", cid);
     auto iter = m_client_map.find(cid);
     if (iter != m_client_map.end())
     {
@@ -61,7 +62,7 @@ void ConnectionManager::RemoveConnection(ClientID cid)
 }
 void ConnectionManager::UpdateConnectionctivityTime(ClientID cid)
 {
-    printf("[ConnectionManager::UpdateConnectionctivityTime] cid: %u, now: %lu\n", cid, Now());
+    EL_LOG_DEBUG("[ConnectionManager::UpdateConnectionctivityTime] cid: %u, now: %lu", cid, Now());
     auto iter = m_client_map.find(cid);
     if (iter != m_client_map.end())
     {
@@ -79,7 +80,7 @@ void ConnectionManager::CloseInactivityConnection()
         time_t act_time = iter->first;
         TcpConnection* conn = iter->second->conn;
         time_t now = Now();
-        printf("[ConnectionManager::CloseInactivityConnection] cid: %u, now: %lu, activity time: %lu\n", conn->ID(), now, act_time);
+        EL_LOG_DEBUG("[ConnectionManager::CloseInactivityConnection] cid: %u, now: %lu, activity time: %lu", conn->ID(), now, act_time);
         uint32_t inactivity_time = now - act_time;
         if (inactivity_time >= m_timeout)
         {
@@ -89,7 +90,7 @@ void ConnectionManager::CloseInactivityConnection()
 
             conn->Disconnect();
 
-            printf("[ConnectionManager::CloseInactivityConnection] Connection inactively in %u seconds, disconnected by server\n", inactivity_time);
+            EL_LOG_INFO("[ConnectionManager::CloseInactivityConnection] Connection inactively in %u seconds, disconnected by server", inactivity_time);
         }
         else
         {
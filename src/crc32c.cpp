@@ -0,0 +1,73 @@
+#include "crc32c.h"
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY     0x82f63b78  // reflected Castagnoli polynomial
+
+namespace evt_loop {
+
+namespace {
+
+struct Crc32cTable {
+  uint32_t entries[256];
+  Crc32cTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int k = 0; k < 8; k++) {
+        crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+      }
+      entries[i] = crc;
+    }
+  }
+};
+
+uint32_t Crc32cSoftware(const char* data, size_t size, uint32_t crc) {
+  static const Crc32cTable table;
+  const uint8_t* p = (const uint8_t*)data;
+  for (size_t i = 0; i < size; i++) {
+    crc = table.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+/// Built for SSE4.2 regardless of the compiler flags and only called once the
+/// CPU is known to support it
+__attribute__((target("sse4.2")))
+uint32_t Crc32cHardware(const char* data, size_t size, uint32_t crc) {
+  const char* p = data;
+  const char* end = data + size;
+  uint64_t crc64 = crc;
+  for (; p + 8 <= end; p += 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = (uint32_t)crc64;
+  for (; p < end; p++) {
+    crc = _mm_crc32_u8(crc, *p);
+  }
+  return crc;
+}
+
+bool HasSse42() {
+  static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+  return has_sse42;
+}
+#endif
+
+}  // namespace
+
+uint32_t Crc32c(const char* data, size_t size, uint32_t crc) {
+  crc = ~crc;
+#if defined(__x86_64__)
+  if (HasSse42()) {
+    return ~Crc32cHardware(data, size, crc);
+  }
+#endif
+  return ~Crc32cSoftware(data, size, crc);
+}
+
+}  // namespace evt_loop
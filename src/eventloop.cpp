@@ -112,7 +112,11 @@ int EventLoop::SetEvent(IOEvent *e, int op)
   ev.events = 0;
   if (events & IOEvent::READ) ev.events |= EPOLLIN;
   if (events & IOEvent::WRITE) ev.events |= EPOLLOUT;
-  if (events & IOEvent::ERROR) ev.events |= EPOLLHUP | EPOLLRDHUP | EPOLLERR;
+  if (events & IOEvent::ERROR) ev.events |= EPOLLHUP | EPOLLERR;
+  /// A half-closed peer maps to no event bit, so RDHUP is only watched with
+  /// reads: level-triggered, it would wake the loop on every pass once a
+  /// source at EOF (e.g. of a TcpRelay) or a paused reader stops reading
+  if ((events & (IOEvent::READ | IOEvent::ERROR)) == (IOEvent::READ | IOEvent::ERROR)) ev.events |= EPOLLRDHUP;
   ev.data.fd = e->fd_;
   ev.data.ptr = e;
 
@@ -121,7 +125,9 @@ int EventLoop::SetEvent(IOEvent *e, int op)
 
 int EventLoop::AddEvent(IOEvent *e) {
   e->el_ = this;
-  SetNonblocking(e->fd_);
+  if (!(e->events_ & IOEvent::NONBLOCK)) {
+    SetNonblocking(e->fd_);
+  }
   return SetEvent(e, EPOLL_CTL_ADD);
 }
 
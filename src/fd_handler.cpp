@@ -1,8 +1,12 @@
 #include "fd_handler.h"
 #include "eventloop.h"
+#include "error_code.h"
+#include "logger.h"
 #include <unistd.h>
+#include <algorithm>
 
-#define MAX_BYTES_RECEIVE       4096
+#define MAX_BYTES_RECEIVE       (64 * 1024)
+#define MAX_SEND_IOVECS         64
 
 namespace evt_loop
 {
@@ -89,56 +93,244 @@ void IOEvent::ClearAllEvents() {
 }
 
 // BufferIOEvent implementation
+BufferIOEvent::~BufferIOEvent() {
+  SetUpstream(NULL);
+  for (size_t i = 0; i < downstreams_.size(); i++) {
+    downstreams_[i]->upstream_ = NULL;
+  }
+}
+
 void BufferIOEvent::ClearBuff() {
   rx_msg_mq_.Clear();
-  tx_msg_mq_.Clear();
+  tx_sched_.Clear();
+  sent_ = 0;
+  rx_batch_.clear();
+  rx_error_ = 0;
+  stream_msg_.reset();
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+  rx_fragments_.reset();
+  rx_frag_discard_ = false;
+#endif
+  CheckWatermarks();
 }
 bool BufferIOEvent::TxBuffEmpty() {
-  return tx_msg_mq_.Empty();
+  return tx_sched_.Empty();
+}
+bool BufferIOEvent::IsIdle() const {
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+  if (rx_fragments_) return false;
+#endif
+  return tx_sched_.Empty() && !stream_msg_;
+}
+/// Moves the bytes of a partially received message out of the receive buffer,
+/// used when the connection leaves message framing (e.g. by joining a TcpRelay)
+size_t BufferIOEvent::TakeRxBuffer(string& data) {
+  if (!rx_msg_mq_.Empty()) {
+    const MessagePtr& last = rx_msg_mq_.Last();
+    if (!last->Empty() && !last->Completion()) {
+      data.append(last->Data());
+    }
+    rx_msg_mq_.Clear();
+  }
+  return data.size();
+}
+
+/// The receive queue stops framing at any header announcing more than this,
+/// so oversized frames are caught before their payload is buffered
+void BufferIOEvent::UpdateSizeLimit() {
+  size_t size_limit = max_msg_size_;
+  if (stream_threshold_ > 0 && (size_limit == 0 || stream_threshold_ < size_limit)) {
+    size_limit = stream_threshold_;
+  }
+  rx_msg_mq_.SetSizeLimit(size_limit);
 }
 
+/// Reads as much as the buffer takes, the framers stop at frame boundaries so
+/// one read may complete many messages. The buffer is only used until the
+/// read has been framed, so one per thread serves all connections.
 int BufferIOEvent::ReceiveData() {
-  char buffer[MAX_BYTES_RECEIVE];
-  int read_bytes = std::min(rx_msg_mq_.NeedMore(), (size_t)sizeof(buffer));
+  static thread_local char buffer[MAX_BYTES_RECEIVE];
+  int read_bytes = sizeof(buffer);
   int len = read(fd_, buffer, read_bytes);
-  printf("[BufferIOEvent::ReceiveData] to read: %d, got: %d\n", read_bytes, len);
+  EL_LOG_DEBUG("[BufferIOEvent::ReceiveData] to read: %d, got: %d", read_bytes, len);
   if (len < 0) {
     OnError(errno, strerror(errno));
   }
   else if (len == 0 ) {
     OnClosed();
-  } else {
-    rx_msg_mq_.AppendData(buffer, len);
-    MessageMQ::MessageDispatcher processing_msg_cb = std::bind(&BufferIOEvent::OnReceived, this, std::placeholders::_1);
-    rx_msg_mq_.Apply(processing_msg_cb);
+  } else if (!ConsumeData(buffer, len)) {
+    return 0;  // closed, this object may be gone already
   }
   return len;
 }
 
+/// Frames received bytes and dispatches complete messages and stream chunks
+/// in arrival order. Returns false when the connection has been closed.
+bool BufferIOEvent::ConsumeData(const char* data, size_t size) {
+  size_t feeds = 0;
+  while (feeds < size) {
+    if (stream_msg_) {
+      size_t taken = 0;
+      if (!StreamData(data + feeds, size - feeds, taken)) {
+        return false;
+      }
+      feeds += taken;
+      continue;
+    }
+    size_t taken = rx_msg_mq_.AppendData(data + feeds, size - feeds);
+    feeds += taken;
+    rx_msg_mq_.Apply(rx_dispatcher_);
+    if (rx_error_ != 0) {
+      /// Messages before the failed one are still delivered
+      int errcode = rx_error_;
+      rx_error_ = 0;
+      FlushBatch();
+      OnError(errcode, rx_error_str_);
+      OnClosed();
+      return false;
+    }
+    if (rx_msg_mq_.Empty() || rx_msg_mq_.Last()->Completion()) {
+      continue;
+    }
+    /// Only the incomplete message is left in the queue now
+    const MessagePtr& last = rx_msg_mq_.Last();
+    size_t expected = last->ExpectedSize();
+    /// Framing can not get past a malformed header, the peer is dropped
+    /// rather than spinning on the same bytes
+    if (taken == 0 || last->Malformed()) {
+      EL_LOG_WARN("[BufferIOEvent::ConsumeData] malformed message, fd: %d", fd_);
+      FlushBatch();
+      OnError(ERR_CODE_MSG_CORRUPT, "malformed message");
+      OnClosed();
+      return false;
+    }
+    if (max_msg_size_ > 0 && std::max(expected, last->Size()) > max_msg_size_) {
+      EL_LOG_WARN("[BufferIOEvent::ConsumeData] message too large, fd: %d, size: %lu, limit: %lu",
+          fd_, std::max(expected, last->Size()), max_msg_size_);
+      FlushBatch();
+      OnError(ERR_CODE_MSG_TOO_LARGE, "message too large");
+      OnClosed();
+      return false;
+    }
+    if (stream_threshold_ > 0 && expected > stream_threshold_) {
+      FlushBatch();  // messages completed before the frame go first
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+      if (last->Type() == MessageType::BINARY && (static_cast<const BinaryMessage*>(last.get())->Header()->flags &
+          (BinaryMessage::FLAG_FRAGMENT | BinaryMessage::FLAG_LZ4 | BinaryMessage::FLAG_ZSTD))) {
+        EL_LOG_WARN("[BufferIOEvent::ConsumeData] fragment or compressed frame above the stream threshold, fd: %d, size: %lu",
+            fd_, expected);
+        OnError(ERR_CODE_MSG_TOO_LARGE, "message too large to stream");
+        OnClosed();
+        return false;
+      }
+#endif
+      stream_msg_ = last;
+      stream_offset_ = 0;
+      stream_crc_ = 0;
+      rx_msg_mq_.EraseFirst();
+      /// Payload bytes taken in with the header make up the first chunk
+      size_t buffered = stream_msg_->Size() - stream_msg_->HeaderSize();
+      size_t none = 0;
+      if ((buffered > 0 || expected == stream_msg_->HeaderSize()) && !StreamData(NULL, 0, none)) {
+        return false;
+      }
+    }
+  }
+  FlushBatch();
+  return true;
+}
+
+/// Delivers payload bytes of the streamed frame, the frame itself keeps only
+/// its header. taken is how much of the data belongs to the frame. Returns
+/// false when the connection has been closed.
+bool BufferIOEvent::StreamData(const char* data, size_t size, size_t& taken) {
+  MessageChunk chunk;
+  chunk.msg = stream_msg_.get();
+  chunk.total = stream_msg_->ExpectedSize() - stream_msg_->HeaderSize();
+  chunk.offset = stream_offset_;
+  if (data == NULL) {
+    chunk.data = stream_msg_->Data().data() + stream_msg_->HeaderSize();
+    chunk.size = stream_msg_->Size() - stream_msg_->HeaderSize();
+  } else {
+    chunk.data = data;
+    chunk.size = std::min(size, chunk.total - stream_offset_);
+  }
+  stream_offset_ += chunk.size;
+  taken = (data == NULL ? 0 : chunk.size);
+
+  MessagePtr msg = stream_msg_;  // keeps the header alive through the callback
+  if (chunk.Last()) {
+    stream_msg_.reset();
+  }
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+  const BinaryMessage::HDR* hdr = (msg->Type() == MessageType::BINARY ?
+      static_cast<const BinaryMessage*>(msg.get())->Header() : NULL);
+  if (hdr && (hdr->flags & BinaryMessage::FLAG_CHECKSUM)) {
+    stream_crc_ = Crc32c(chunk.data, chunk.size, stream_crc_);
+    if (chunk.Last() && stream_crc_ != hdr->checksum) {
+      EL_LOG_WARN("[BufferIOEvent::StreamData] checksum mismatch, fd: %d, size: %lu", fd_, chunk.total);
+      FlushBatch();
+      OnError(ERR_CODE_MSG_CORRUPT, "message checksum mismatch");
+      OnClosed();
+      return false;
+    }
+  }
+#endif
+  OnReceivedChunk(chunk);
+  return true;
+}
+
+/// Writes as many frames of the wire queue as possible with a single writev(),
+/// the scheduler tops the wire queue up from the lanes at frame boundaries
 int BufferIOEvent::SendData() {
   uint32_t cur_sent = 0;
-  while (!tx_msg_mq_.Empty()) {
-    const MessagePtr& tx_msg = tx_msg_mq_.First();
-    uint32_t tosend = tx_msg->Size();
-    int len = write(fd_, tx_msg->Data().data() + sent_, tosend - sent_);
+  tx_sched_.Schedule();
+  while (tx_sched_.WireSize() > 0) {
+    struct iovec iov[MAX_SEND_IOVECS];
+    int iovcnt = 0;
+    size_t tosend = 0;
+    for (size_t i = 0; i < tx_sched_.WireSize() && iovcnt < MAX_SEND_IOVECS; i++) {
+      const MessagePtr& tx_msg = tx_sched_.WireAt(i).data;
+      size_t offset = (i == 0 ? sent_ : 0);
+      iov[iovcnt].iov_base = (void*)(tx_msg->Data().data() + offset);
+      iov[iovcnt].iov_len = tx_msg->Size() - offset;
+      tosend += iov[iovcnt].iov_len;
+      iovcnt++;
+    }
+    ssize_t len = writev(fd_, iov, iovcnt);
     if (len < 0) {
-      OnError(errno, strerror(errno));
+      if (errno != EAGAIN && errno != EINTR) {
+        OnError(errno, strerror(errno));
+      }
       break;
     }
-    sent_ += len;
     cur_sent += len;
-    if (sent_ == tosend) {
-      OnSent(tx_msg.get());
-      tx_msg_mq_.EraseFirst();
+    /// Retire every message that has been written completely
+    size_t left = len;
+    while (tx_sched_.WireSize() > 0) {
+      TxScheduler::Frame& frame = tx_sched_.WireAt(0);
+      size_t remain = frame.data->Size() - sent_;
+      if (left < remain) {
+        sent_ += left;
+        break;
+      }
+      left -= remain;
       sent_ = 0;
-    } else {
-      /// sent_ less than tosend, breaking the sending loop and wait for next writing event
+      MessagePtr done;
+      done.swap(frame.done);
+      tx_sched_.PopWire();
+      if (done) OnSent(done.get());
+    }
+    if ((size_t)len < tosend) {
+      /// The socket buffer is full, breaking the sending loop and wait for next writing event
       break;
     }
+    tx_sched_.Schedule();
   }
-  if (tx_msg_mq_.Empty()) {
+  if (tx_sched_.Empty()) {
     DeleteWriteEvent();  // All data in the output buffer has been sent, then remove writing event from epoll
   }
+  CheckWatermarks();
   return cur_sent;
 }
 
@@ -148,7 +340,7 @@ void BufferIOEvent::OnEvents(uint32_t events) {
     SendData();
   }
   if (events & IOEvent::READ) {
-    ReceiveData();
+    if (ReceiveData() == 0) return;
   }
   if (events & IOEvent::ERROR) {
     OnError(errno, strerror(errno));
@@ -159,35 +351,365 @@ void BufferIOEvent::Send(const Message& msg) {
   MessagePtr msg_ptr = CreateMessage(msg);
 #ifdef _BINARY_MSG_EXTEND_PACKAGING
   if (msg_type_ == MessageType::BINARY) {
-    BinaryMessage* bmsg = static_cast<BinaryMessage*>(msg_ptr.get());
-    bmsg->Header()->msg_id = ++msg_seq_;
+    StampHeader(msg_ptr);
   }
 #endif
   SendInner(msg_ptr);
 }
 
+/// Queues the message itself instead of a copy, the caller gives up the ownership
+void BufferIOEvent::Send(MessagePtr&& msg) {
+  SendOnLane(TX_LANE_NORMAL, std::move(msg));
+}
+
+void BufferIOEvent::SendOnLane(TxLane lane, MessagePtr&& msg) {
+  if (!msg) return;
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+  if (msg->Type() == MessageType::BINARY) {
+    StampHeader(msg);
+  }
+#endif
+  MessagePtr msg_ptr(std::move(msg));
+  SendInner(msg_ptr, lane);
+}
+
+void BufferIOEvent::SendShared(const MessagePtr& msg, TxLane lane) {
+  if (msg) SendInner(msg, lane);
+}
+
 void BufferIOEvent::Send(const string& data, bool bmsg_has_hdr) {
   Send(data.data(), data.size(), bmsg_has_hdr);
 }
 
 void BufferIOEvent::Send(const char *data, uint32_t len, bool bmsg_has_hdr) {
-  MessagePtr msg_ptr = CreateMessage(msg_type_, data, len, bmsg_has_hdr);
+  SendOnLane(TX_LANE_NORMAL, data, len, bmsg_has_hdr);
+}
+
+void BufferIOEvent::SendOnLane(TxLane lane, const char *data, uint32_t len, bool bmsg_has_hdr) {
+  MessagePtr msg_ptr = framing_.Valid() ? CreateMessage(framing_, data, len, bmsg_has_hdr)
+                                        : CreateMessage(msg_type_, data, len, bmsg_has_hdr);
   if (msg_type_ == MessageType::BINARY) {
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+    StampHeader(msg_ptr);
+#endif
     BinaryMessage* bmsg = static_cast<BinaryMessage*>(msg_ptr.get());
+    EL_LOG_DEBUG("[BufferIOEvent::Send] HDR: %s", bmsg->Header()->ToString().c_str());
+  }
+  EL_LOG_DEBUG("[BufferIOEvent::Send] message size: %ld", msg_ptr->Size());
+  SendInner(msg_ptr, lane);
+}
+
+void BufferIOEvent::Send(const struct iovec* iov, int iovcnt) {
+  if (iov == NULL || iovcnt <= 0) return;
+
+  struct iovec vec[MAX_SEND_IOVECS];
+  size_t payload_size = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    payload_size += iov[i].iov_len;
+  }
+  /// An NDJSON line is terminated depending on its content, and the
+  /// compressor needs the payload in one piece
+  bool gather = (msg_type_ == MessageType::NDJSON && !framing_.Valid());
 #ifdef _BINARY_MSG_EXTEND_PACKAGING
-    bmsg->Header()->msg_id = ++msg_seq_;
+  gather |= (msg_type_ == MessageType::BINARY && compression_.type != COMPRESS_NONE && payload_size >= compression_.threshold);
 #endif
-    printf("[BufferIOEvent::Send] HDR: %s\n", bmsg->Header()->ToString().c_str());
+  if (gather) {
+    string payload;
+    payload.reserve(payload_size);
+    for (int i = 0; i < iovcnt; i++) {
+      payload.append((const char*)iov[i].iov_base, iov[i].iov_len);
+    }
+    Send(payload.data(), payload.size());
+    return;
   }
-  printf("[BufferIOEvent::Send] message size: %ld\n", msg_ptr->Size());
-  SendInner(msg_ptr);
+
+  /// Only the header is framed, the payload stays in the caller's fragments
+  char hdr_buf[MAX_FRAME_HEADER_SIZE];
+  size_t hdr_size = 0;
+  if (msg_type_ == MessageType::BINARY) {
+    BinaryMessage::HDR hdr;
+    hdr.length = payload_size + sizeof(hdr);
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+    hdr.msg_id = ++msg_seq_;
+    if (checksum_) {
+      uint32_t crc = 0;
+      for (int i = 0; i < iovcnt; i++) {
+        crc = Crc32c((const char*)iov[i].iov_base, iov[i].iov_len, crc);
+      }
+      hdr.checksum = crc;
+      hdr.flags |= BinaryMessage::FLAG_CHECKSUM;
+    }
+#endif
+    hdr_size = sizeof(hdr);
+    memcpy(hdr_buf, &hdr, hdr_size);
+  } else if (framing_.Valid()) {
+    hdr_size = framing_.write_header(hdr_buf, payload_size);
+  } else if (msg_type_ == MessageType::TLV) {
+    TlvHeader hdr;
+    hdr.tag = TLVMessage::DEFAULT_TAG;
+    hdr.length = payload_size;
+    hdr_size = sizeof(hdr);
+    memcpy(hdr_buf, &hdr, hdr_size);
+  }
+
+  ssize_t written = 0;
+  if (tx_sched_.Empty() && iovcnt < MAX_SEND_IOVECS && !Relayed()) {
+    int n = 0;
+    if (hdr_size > 0) {
+      vec[n].iov_base = hdr_buf;
+      vec[n].iov_len = hdr_size;
+      n++;
+    }
+    memcpy(&vec[n], iov, iovcnt * sizeof(struct iovec));
+    n += iovcnt;
+    written = writev(fd_, vec, n);
+    if (written < 0) {
+      if (errno != EAGAIN && errno != EINTR) {
+        OnError(errno, strerror(errno));
+        return;
+      }
+      written = 0;
+    }
+    if ((size_t)written == hdr_size + payload_size) {
+      return;
+    }
+  }
+
+  /// The socket can not take all of it now, queue the whole frame and skip what was written
+  MessagePtr msg_ptr = framing_.Valid() ? framing_.create() : CreateMessage(msg_type_);
+  msg_ptr->Reserve(hdr_size + payload_size);
+  if (framing_.Valid()) {
+    /// Run the frame through the framer so the message knows its header
+    msg_ptr->AppendData(hdr_buf, hdr_size);
+  } else {
+    msg_ptr->AppendRawData(hdr_buf, hdr_size);
+  }
+  for (int i = 0; i < iovcnt; i++) {
+    msg_ptr->AppendRawData((const char*)iov[i].iov_base, iov[i].iov_len);
+  }
+  if (msg_type_ == MessageType::BINARY) {
+    static_cast<BinaryMessage*>(msg_ptr.get())->ResetHeader();
+  }
+  if (written > 0) {
+    /// Partly on the wire already, so it can not wait in a lane
+    tx_sched_.PushWire(msg_ptr, false);
+    sent_ = written;  // the queue was empty, so this message is the first one
+    AddWriteEvent();
+    CheckWatermarks();
+    return;
+  }
+  SendInner(msg_ptr, TX_LANE_NORMAL, false);
 }
 
-void BufferIOEvent::SendInner(const MessagePtr& msg) {
-  tx_msg_mq_.Push(msg);
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+void BufferIOEvent::StampHeader(MessagePtr& msg) {
+  BinaryMessage* bmsg = static_cast<BinaryMessage*>(msg.get());
+  if (compression_.type != COMPRESS_NONE && bmsg->PayloadSize() >= compression_.threshold) {
+    MessagePtr compressed = Compress(bmsg);
+    if (compressed) {
+      msg = compressed;
+      bmsg = static_cast<BinaryMessage*>(msg.get());
+    }
+  }
+  bmsg->Header()->msg_id = ++msg_seq_;
+  if (checksum_) {
+    bmsg->SetChecksum();  // covers the payload as it goes on the wire
+  }
+}
+
+/// Returns a copy of the message with its payload compressed, or NULL when
+/// compression does not pay off
+MessagePtr BufferIOEvent::Compress(const BinaryMessage* bmsg) {
+  static thread_local string block;
+  if (!Compressor::Instance().Compress(compression_, bmsg->Payload(), bmsg->PayloadSize(), block)) {
+    return MessagePtr();
+  }
+  BinaryMessage::HDR hdr = *bmsg->Header();
+  hdr.length = sizeof(hdr) + block.size();
+  /// A checksum of the original payload does not match the block, StampHeader
+  /// computes a new one if checksums are on
+  hdr.flags &= ~BinaryMessage::FLAG_CHECKSUM;
+  hdr.checksum = 0;
+  hdr.flags |= (compression_.type == COMPRESS_LZ4 ? BinaryMessage::FLAG_LZ4 : BinaryMessage::FLAG_ZSTD);
+  MessagePtr msg_ptr = CreateMessage(MessageType::BINARY);
+  msg_ptr->Reserve(hdr.length);
+  msg_ptr->AppendRawData((const char*)&hdr, sizeof(hdr));
+  msg_ptr->AppendRawData(block.data(), block.size());
+  static_cast<BinaryMessage*>(msg_ptr.get())->ResetHeader();
+  return msg_ptr;
+}
+
+/// Restores a received compressed payload, NULL when the block is invalid
+MessagePtr BufferIOEvent::Decompress(const BinaryMessage* bmsg) {
+  static thread_local string plain;
+  uint8_t flags = bmsg->Header()->flags;
+  CompressionType type = (flags & BinaryMessage::FLAG_LZ4) ? COMPRESS_LZ4 : COMPRESS_ZSTD;
+  size_t max_size = max_msg_size_ > sizeof(BinaryMessage::HDR) ? max_msg_size_ - sizeof(BinaryMessage::HDR) : 0;
+  if (!Compressor::Instance().Decompress(type, compression_.dict.get(), bmsg->Payload(), bmsg->PayloadSize(),
+        max_size, plain)) {
+    return MessagePtr();
+  }
+  BinaryMessage::HDR hdr = *bmsg->Header();
+  hdr.length = sizeof(hdr) + plain.size();
+  hdr.flags &= ~(BinaryMessage::FLAG_LZ4 | BinaryMessage::FLAG_ZSTD | BinaryMessage::FLAG_CHECKSUM);
+  MessagePtr msg_ptr = CreateMessage(MessageType::BINARY);
+  msg_ptr->Reserve(hdr.length);
+  msg_ptr->AppendRawData((const char*)&hdr, sizeof(hdr));
+  msg_ptr->AppendRawData(plain.data(), plain.size());
+  static_cast<BinaryMessage*>(msg_ptr.get())->ResetHeader();
+  return msg_ptr;
+}
+#endif
+
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+/// Joins the fragments of a message, returns it once the last one is in
+MessagePtr BufferIOEvent::Reassemble(MessagePtr& frag) {
+  const BinaryMessage* bfrag = static_cast<const BinaryMessage*>(frag.get());
+  bool last = !(bfrag->Header()->flags & BinaryMessage::FLAG_MORE_FRAGMENTS);
+  if (rx_frag_discard_) {
+    rx_frag_discard_ = !last;
+    return MessagePtr();
+  }
+  if (!rx_fragments_) {
+    BinaryMessage::HDR hdr = *bfrag->Header();
+    hdr.flags &= ~(BinaryMessage::FLAG_FRAGMENT | BinaryMessage::FLAG_MORE_FRAGMENTS | BinaryMessage::FLAG_CHECKSUM);
+    rx_fragments_ = CreateMessage(MessageType::BINARY);
+    rx_fragments_->AppendRawData((const char*)&hdr, sizeof(hdr));
+  }
+  rx_fragments_->AppendRawData(bfrag->Payload(), bfrag->PayloadSize());
+  if (max_msg_size_ > 0 && rx_fragments_->Size() > max_msg_size_) {
+    EL_LOG_WARN("[BufferIOEvent::Reassemble] message too large, fd: %d, size: %lu", fd_, rx_fragments_->Size());
+    rx_fragments_.reset();
+    rx_frag_discard_ = !last;
+    FailMessage(ERR_CODE_MSG_TOO_LARGE, "message too large");
+    return MessagePtr();
+  }
+  if (!last) {
+    return MessagePtr();
+  }
+  MessagePtr whole;
+  whole.swap(rx_fragments_);
+  BinaryMessage* bmsg = static_cast<BinaryMessage*>(whole.get());
+  bmsg->ResetHeader();
+  bmsg->Header()->length = bmsg->Size();
+  return whole;
+}
+#endif
+
+void BufferIOEvent::OnReceivedBatch(std::vector<MessagePtr>& msgs) {
+  for (size_t i = 0; i < msgs.size(); i++) {
+    OnReceivedMessage(msgs[i]);
+  }
+}
+
+void BufferIOEvent::FlushBatch() {
+  if (!rx_batch_.empty()) {
+    OnReceivedBatch(rx_batch_);
+    rx_batch_.clear();
+  }
+}
+
+/// The first failure of a read is kept, ConsumeData() reports it and closes
+/// the connection once the receive queue has been walked
+void BufferIOEvent::FailMessage(int errcode, const char* errstr) {
+  if (rx_error_ == 0) {
+    rx_error_ = errcode;
+    rx_error_str_ = errstr;
+  }
+}
+
+/// Queues a complete message for the batch of this read. A message failing
+/// its integrity check fails the connection, those after it are dropped.
+void BufferIOEvent::CollectMessage(MessagePtr& msg) {
+  if (rx_error_ != 0) {
+    return;
+  }
+  /// An unframed message may complete within the read that took it past the limit
+  if (max_msg_size_ > 0 && msg->Size() > max_msg_size_) {
+    EL_LOG_WARN("[BufferIOEvent::CollectMessage] message too large, fd: %d, size: %lu, limit: %lu",
+        fd_, msg->Size(), max_msg_size_);
+    FailMessage(ERR_CODE_MSG_TOO_LARGE, "message too large");
+    return;
+  }
+  if (!msg->Intact()) {
+    EL_LOG_WARN("[BufferIOEvent::CollectMessage] checksum mismatch, fd: %d, size: %lu", fd_, msg->Size());
+    FailMessage(ERR_CODE_MSG_CORRUPT, "message checksum mismatch");
+    return;
+  }
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+  if (msg->Type() == MessageType::BINARY) {
+    const BinaryMessage* bmsg = static_cast<const BinaryMessage*>(msg.get());
+    if (bmsg->Header()->flags & BinaryMessage::FLAG_FRAGMENT) {
+      MessagePtr whole = Reassemble(msg);
+      if (!whole) return;
+      return CollectMessage(whole);
+    }
+    if (bmsg->Header()->flags & (BinaryMessage::FLAG_LZ4 | BinaryMessage::FLAG_ZSTD)) {
+      MessagePtr plain = Decompress(bmsg);
+      if (!plain) {
+        EL_LOG_WARN("[BufferIOEvent::CollectMessage] failed to decompress, fd: %d, size: %lu", fd_, msg->Size());
+        FailMessage(ERR_CODE_MSG_CORRUPT, "message decompression failed");
+        return;
+      }
+      rx_batch_.push_back(plain);
+      return;
+    }
+  }
+#endif
+  rx_batch_.push_back(std::move(msg));
+}
+
+void BufferIOEvent::SendInner(const MessagePtr& msg, TxLane lane, bool report) {
+  tx_sched_.Push(msg, lane, report);
   if (!(events_ & IOEvent::WRITE)) {
     AddWriteEvent();  // The output buffer has data now, then add writing event to epoll again if epoll has no writing event
   }
+  CheckWatermarks();
+}
+
+void BufferIOEvent::SetWriteWatermarks(size_t high, size_t low) {
+  tx_high_watermark_ = high;
+  tx_low_watermark_ = low < high ? low : high;
+  CheckWatermarks();
+}
+
+/// Reading stops with the first downstream above its high watermark and
+/// resumes once none is
+void BufferIOEvent::Pause() {
+  if (paused_by_++ == 0) DeleteReadEvent();
+}
+void BufferIOEvent::Unpause() {
+  if (paused_by_ > 0 && --paused_by_ == 0) AddReadEvent();
+}
+
+/// Both sides keep a link, so whichever is destroyed first detaches the other
+void BufferIOEvent::SetUpstream(BufferIOEvent* upstream) {
+  if (upstream_) {
+    if (tx_above_high_) upstream_->Unpause();
+    std::vector<BufferIOEvent*>& peers = upstream_->downstreams_;
+    peers.erase(std::remove(peers.begin(), peers.end(), this), peers.end());
+  }
+  upstream_ = upstream;
+  if (upstream_) {
+    upstream_->downstreams_.push_back(this);
+    if (tx_above_high_) upstream_->Pause();
+  }
+}
+
+/// Raises the watermark events when the output buffer crosses high on the
+/// way up or low on the way down, a connection between them keeps its state
+void BufferIOEvent::CheckWatermarks() {
+  size_t queued = TxQueuedBytes();
+  if (!tx_above_high_) {
+    if (tx_high_watermark_ == 0 || queued <= tx_high_watermark_) return;
+    tx_above_high_ = true;
+    if (upstream_) upstream_->Pause();
+    OnHighWatermark(queued);
+  } else if (tx_high_watermark_ == 0 || queued <= tx_low_watermark_) {
+    tx_above_high_ = false;
+    if (upstream_) upstream_->Unpause();
+    OnLowWatermark(queued);
+  }
 }
 
 }  // namespace evt_loop
@@ -0,0 +1,346 @@
+#include "eventloop.h"
+#include "handover.h"
+#include "logger.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define HANDOVER_TIMEOUT_MS     5000
+#define HANDOVER_MAX_PAYLOAD    (64 * 1024)     // busier connections stay to be drained
+#define HANDOVER_MAX_NAME       256
+#define HANDOVER_ACK            'A'
+
+namespace evt_loop {
+
+/// The header of every message, the name and the pending bytes follow it.
+/// A message of kind 0 without a socket ends the transfer.
+struct HandoverHeader
+{
+    uint32_t    kind;
+    uint32_t    name_len;
+};
+
+static bool UnixSeqpacketAddr(const char* path, struct sockaddr_storage& sock_addr, socklen_t& len)
+{
+    return IPAddressToSocketAddr(IPAddress(string(UNIX_ADDR_PREFIX) + path), sock_addr, len);
+}
+
+static void SetTimeouts(int fd, int timeout_ms)
+{
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+bool SendSocket(int sock, int fd, const string& payload)
+{
+    struct iovec iov;
+    iov.iov_base = (void*)payload.data();
+    iov.iov_len = payload.size();
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    ssize_t ret;
+    do {
+        ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (ret == -1 && errno == EINTR);
+    return ret == (ssize_t)payload.size();
+}
+
+int RecvSocket(int sock, int& fd, string& payload)
+{
+    fd = -1;
+    payload.resize(sizeof(HandoverHeader) + HANDOVER_MAX_NAME + HANDOVER_MAX_PAYLOAD);
+    struct iovec iov;
+    iov.iov_base = &payload[0];
+    iov.iov_len = payload.size();
+    char control[CMSG_SPACE(sizeof(int))];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t ret;
+    do {
+        ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (ret == -1 && errno == EINTR);
+    if (ret < 0) {
+        payload.clear();
+        return -1;
+    }
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    payload.resize(ret);
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+        if (fd >= 0) close(fd);
+        fd = -1;
+        payload.clear();
+        return -1;
+    }
+    return ret;
+}
+
+static bool SendHandoverSocket(int sock, uint32_t kind, const string& name, int fd, const string& pending)
+{
+    HandoverHeader hdr;
+    if (name.size() > HANDOVER_MAX_NAME) {
+        return false;
+    }
+    hdr.kind = kind;
+    hdr.name_len = name.size();
+    string payload((const char*)&hdr, sizeof(hdr));
+    payload.append(name).append(pending);
+    return SendSocket(sock, fd, payload);
+}
+
+HandoverServer::HandoverServer(const char* path, const OnHandedOverCallback& handed_over_cb)
+    : IOEvent(-1, IOEvent::READ | IOEvent::ERROR | IOEvent::NONBLOCK),
+      path_(path), allowed_uid_(geteuid()), allowed_gid_((gid_t)-1), handed_over_cb_(handed_over_cb)
+{
+    Listen();
+}
+
+HandoverServer::~HandoverServer()
+{
+    Close();
+}
+
+void HandoverServer::AllowPeer(uid_t uid, gid_t gid)
+{
+    allowed_uid_ = uid;
+    allowed_gid_ = gid;
+}
+
+void HandoverServer::AddServer(const string& name, TcpServer* server, bool with_connections)
+{
+    Entry entry;
+    entry.name = name;
+    entry.server = server;
+    entry.with_connections = with_connections;
+    servers_.push_back(entry);
+}
+
+bool HandoverServer::Listen()
+{
+    struct sockaddr_storage sock_addr;
+    socklen_t addr_len = 0;
+    if (!UnixSeqpacketAddr(path_.c_str(), sock_addr, addr_len)) {
+        EL_LOG_ERROR("[HandoverServer::Listen] invalid path: %s", path_.c_str());
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        EL_LOG_ERROR("[HandoverServer::Listen] socket: %s", strerror(errno));
+        return false;
+    }
+    if (path_[0] != '@') {
+        unlink(path_.c_str());  // the path belongs to this service, left behind by a predecessor
+    }
+    if (bind(fd, (sockaddr*)&sock_addr, addr_len) == -1 || listen(fd, 1) == -1) {
+        EL_LOG_ERROR("[HandoverServer::Listen] bind %s: %s", path_.c_str(), strerror(errno));
+        close(fd);
+        return false;
+    }
+    if (path_[0] != '@') {
+        chmod(path_.c_str(), S_IRUSR | S_IWUSR);    // connecting takes write permission
+    }
+    SetFD(fd);
+    return true;
+}
+
+/// The path is given up before the transfer ends, so the new process can
+/// listen on it for its own successor right away
+void HandoverServer::Close()
+{
+    if (fd_ < 0) {
+        return;
+    }
+    int fd = fd_;
+    SetFD(-1);
+    close(fd);
+    if (path_[0] != '@') {
+        unlink(path_.c_str());
+    }
+}
+
+void HandoverServer::OnEvents(uint32_t events)
+{
+    if (!(events & IOEvent::READ)) {
+        return;
+    }
+    int fd = accept4(fd_, NULL, NULL, SOCK_CLOEXEC);    // blocking, bounded by the timeouts
+    if (fd < 0) {
+        return;
+    }
+    if (!PeerAllowed(fd)) {
+        close(fd);
+        return;
+    }
+    SetTimeouts(fd, HANDOVER_TIMEOUT_MS);
+    size_t count = HandOver(fd);
+    close(fd);
+    if (count > 0 && handed_over_cb_) {
+        handed_over_cb_(count);
+    }
+}
+
+/// The credentials are those of the peer process when it connected
+bool HandoverServer::PeerAllowed(int fd)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+        EL_LOG_ERROR("[HandoverServer::PeerAllowed] SO_PEERCRED: %s", strerror(errno));
+        return false;
+    }
+    if (cred.uid != allowed_uid_ || (allowed_gid_ != (gid_t)-1 && cred.gid != allowed_gid_)) {
+        EL_LOG_WARN("[HandoverServer::PeerAllowed] refused pid: %d, uid: %u, gid: %u",
+            (int)cred.pid, (unsigned)cred.uid, (unsigned)cred.gid);
+        return false;
+    }
+    return true;
+}
+
+/// Listening sockets go first, so the new process is accepting before the
+/// connections arrive. The servers only stop accepting once the new process
+/// has confirmed, until then both of them accept.
+size_t HandoverServer::HandOver(int fd)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < servers_.size(); i++) {
+        TcpServer* server = servers_[i].server;
+        if (!server->Accepting()) {
+            continue;
+        }
+        if (!SendHandoverSocket(fd, HandoverSocket::LISTENER, servers_[i].name, server->FD(), string())) {
+            EL_LOG_ERROR("[HandoverServer::HandOver] sending listener %s: %s", servers_[i].name.c_str(), strerror(errno));
+            return 0;
+        }
+        count++;
+    }
+    /// Sent connections are kept open here until the new process confirms
+    std::vector<Detached> sent;
+    for (size_t i = 0; i < servers_.size(); i++) {
+        if (!servers_[i].with_connections) {
+            continue;
+        }
+        TcpServer* server = servers_[i].server;
+        std::vector<int> fds;
+        server->ForEachConnection([&](TcpConnection* conn) { fds.push_back(conn->FD()); });
+        for (size_t j = 0; j < fds.size(); j++) {
+            Detached conn;
+            conn.server = server;
+            conn.fd = server->DetachConnection(fds[j], conn.pending, HANDOVER_MAX_PAYLOAD);
+            if (conn.fd < 0) {
+                continue;   // busy, it is drained here
+            }
+            if (!SendHandoverSocket(fd, HandoverSocket::CONNECTION, servers_[i].name, conn.fd, conn.pending)) {
+                EL_LOG_WARN("[HandoverServer::HandOver] connection fd %d of %s kept", conn.fd, servers_[i].name.c_str());
+                server->AdoptConnection(conn.fd, conn.pending);
+                continue;
+            }
+            sent.push_back(conn);
+            count++;
+        }
+    }
+
+    Close();
+    char ack = 0;
+    if (!SendHandoverSocket(fd, 0, string(), -1, string()) || recv(fd, &ack, 1, 0) != 1 || ack != HANDOVER_ACK) {
+        EL_LOG_ERROR("[HandoverServer::HandOver] not confirmed, keep on serving: %s", strerror(errno));
+        for (size_t i = 0; i < sent.size(); i++) {
+            sent[i].server->AdoptConnection(sent[i].fd, sent[i].pending);
+        }
+        Listen();
+        return 0;
+    }
+    for (size_t i = 0; i < sent.size(); i++) {
+        close(sent[i].fd);
+    }
+    for (size_t i = 0; i < servers_.size(); i++) {
+        servers_[i].server->StopAccepting();
+    }
+    EL_LOG_INFO("[HandoverServer::HandOver] %lu sockets handed over", count);
+    return count;
+}
+
+bool ReceiveHandover(const char* path, std::vector<HandoverSocket>& sockets, int timeout_ms)
+{
+    struct sockaddr_storage sock_addr;
+    socklen_t addr_len = 0;
+    if (!UnixSeqpacketAddr(path, sock_addr, addr_len)) {
+        return false;
+    }
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        return false;
+    }
+    SetTimeouts(sock, timeout_ms);
+    if (connect(sock, (sockaddr*)&sock_addr, addr_len) == -1) {
+        close(sock);
+        return false;   // nobody to take over from
+    }
+
+    size_t first = sockets.size();
+    bool done = false;
+    while (!done) {
+        int fd = -1;
+        string payload;
+        if (RecvSocket(sock, fd, payload) < (int)sizeof(HandoverHeader)) {
+            if (fd >= 0) close(fd);
+            break;
+        }
+        HandoverHeader hdr;
+        memcpy(&hdr, payload.data(), sizeof(hdr));
+        if (hdr.kind == 0) {
+            done = true;
+            break;
+        }
+        if (fd < 0 || sizeof(hdr) + hdr.name_len > payload.size()) {
+            if (fd >= 0) close(fd);
+            break;
+        }
+        HandoverSocket item;
+        item.kind = hdr.kind;
+        item.name = payload.substr(sizeof(hdr), hdr.name_len);
+        item.fd = fd;
+        item.pending = payload.substr(sizeof(hdr) + hdr.name_len);
+        sockets.push_back(item);
+    }
+
+    char ack = HANDOVER_ACK;
+    if (!done || send(sock, &ack, 1, MSG_NOSIGNAL) != 1) {
+        EL_LOG_ERROR("[ReceiveHandover] transfer from %s failed", path);
+        for (size_t i = first; i < sockets.size(); i++) {
+            close(sockets[i].fd);
+        }
+        sockets.resize(first);
+        close(sock);
+        return false;
+    }
+    close(sock);
+    EL_LOG_INFO("[ReceiveHandover] %lu sockets taken over from %s", sockets.size() - first, path);
+    return true;
+}
+
+}  // namespace evt_loop
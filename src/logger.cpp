@@ -0,0 +1,233 @@
+#include "logger.h"
+#include <stdlib.h>
+#include <algorithm>
+#include <time.h>
+#include <sys/time.h>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define LOG_RING_SIZE         (1 << 20)   // bytes per thread
+#define LOG_LINE_SIZE         4096        // longer records are truncated
+#define LOG_FLUSH_INTERVAL_MS 10          // idle poll of the flusher
+
+namespace evt_loop {
+
+LogRing::LogRing(size_t capacity) :
+  dropped(0), retired(false), buffer_(NULL), capacity_(8), pending_(0), writing_(false), head_(0), tail_(0)
+{
+  while (capacity_ < capacity) capacity_ <<= 1;
+  buffer_ = (char*)malloc(capacity_);
+}
+
+LogRing::~LogRing()
+{
+  free(buffer_);
+}
+
+/// Records are kept contiguous, one that does not fit in front of the end of
+/// the buffer starts over at its beginning behind a wrap marker
+LogRecord* LogRing::Reserve(size_t size)
+{
+  if (writing_.load(std::memory_order_relaxed)) {
+    return NULL;
+  }
+  writing_.store(true, std::memory_order_relaxed);
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  size = (size + 7) & ~(size_t)7;
+  size_t head = head_.load(std::memory_order_relaxed);
+  size_t tail = tail_.load(std::memory_order_acquire);
+  size_t pos = head & (capacity_ - 1);
+  size_t skip = (capacity_ - pos < size) ? capacity_ - pos : 0;
+  if (size > capacity_ || capacity_ - (head - tail) < skip + size) {
+    writing_.store(false, std::memory_order_relaxed);
+    return NULL;
+  }
+  if (skip > 0) {
+    ((LogRecord*)(buffer_ + pos))->size = 0;
+    head += skip;
+    pos = 0;
+  }
+  LogRecord* record = (LogRecord*)(buffer_ + pos);
+  record->size = size;
+  pending_ = head + size;
+  return record;
+}
+
+void LogRing::Commit()
+{
+  head_.store(pending_, std::memory_order_release);
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  writing_.store(false, std::memory_order_relaxed);
+}
+
+namespace {
+
+const char LEVEL_TAGS[] = { 'D', 'I', 'W', 'E' };
+
+/// Rings of all threads and the flusher draining them
+class LogBackend {
+ public:
+  LogBackend() : out_(stdout), ring_size_(LOG_RING_SIZE), stop_(false) { }
+
+  std::shared_ptr<LogRing> Register() {
+    std::lock_guard<std::mutex> guard(rings_mutex_);
+    std::shared_ptr<LogRing> ring = std::make_shared<LogRing>(ring_size_);
+    rings_.push_back(ring);
+    if (!flusher_.joinable() && !stop_) {
+      flusher_ = std::thread(&LogBackend::Run, this);
+    }
+    return ring;
+  }
+
+  void SetOutput(FILE* out) {
+    std::lock_guard<std::mutex> guard(drain_mutex_);
+    out_ = out;
+  }
+  void SetRingSize(size_t size) {
+    std::lock_guard<std::mutex> guard(rings_mutex_);
+    ring_size_ = size;
+  }
+
+  /// The consumer side of every ring, one thread at a time
+  size_t Drain() {
+    std::vector<std::shared_ptr<LogRing> > rings;
+    {
+      std::lock_guard<std::mutex> guard(rings_mutex_);
+      rings = rings_;
+    }
+    std::lock_guard<std::mutex> guard(drain_mutex_);
+    size_t count = 0;
+    for (size_t i = 0; i < rings.size(); i++) {
+      count += rings[i]->Drain(*this);
+      uint64_t dropped = rings[i]->dropped.exchange(0, std::memory_order_relaxed);
+      if (dropped > 0) {
+        fprintf(out_, "[Logger] %lu records dropped, the ring is full\n", dropped);
+      }
+    }
+    if (count > 0) fflush(out_);
+    Prune();
+    return count;
+  }
+
+  void operator()(const LogRecord* record) {
+    char line[LOG_LINE_SIZE];
+    time_t seconds = record->time_us / 1000000;
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    size_t n = strftime(line, sizeof(line), "%Y-%m-%d %H:%M:%S", &tm);
+    n += snprintf(line + n, sizeof(line) - n, ".%06ld [%c] ",
+        (long)(record->time_us % 1000000), LEVEL_TAGS[record->level]);
+    int len = record->format(line + n, sizeof(line) - n, record->fmt, (const char*)(record + 1));
+    if (len > 0) n = std::min(n + len, sizeof(line) - 1);
+    fwrite(line, 1, n, out_);
+    fputc('\n', out_);
+  }
+
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> guard(rings_mutex_);
+      stop_ = true;
+    }
+    if (flusher_.joinable()) flusher_.join();
+    Drain();
+  }
+
+ private:
+  void Run() {
+    while (true) {
+      {
+        std::lock_guard<std::mutex> guard(rings_mutex_);
+        if (stop_) break;
+      }
+      if (Drain() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS));
+      }
+    }
+  }
+
+  /// Rings of exited threads go once they have been drained
+  void Prune() {
+    std::lock_guard<std::mutex> guard(rings_mutex_);
+    for (size_t i = 0; i < rings_.size(); ) {
+      if (rings_[i]->retired.load(std::memory_order_acquire)) {
+        rings_[i]->Drain(*this);
+        rings_.erase(rings_.begin() + i);
+      } else {
+        i++;
+      }
+    }
+  }
+
+ private:
+  FILE*       out_;
+  size_t      ring_size_;
+  bool        stop_;
+  std::mutex  rings_mutex_;
+  std::mutex  drain_mutex_;
+  std::vector<std::shared_ptr<LogRing> > rings_;
+  std::thread flusher_;
+};
+
+/// Never destroyed, records may still be written by static destructors
+LogBackend& Backend() {
+  static LogBackend* backend = new LogBackend();
+  return *backend;
+}
+
+/// Marks the ring of an exiting thread for removal
+struct ThreadRingHolder {
+  ~ThreadRingHolder() { if (ring) ring->retired.store(true, std::memory_order_release); }
+  std::shared_ptr<LogRing> ring;
+};
+
+}  // namespace
+
+std::atomic<int>  Logger::level_(EL_LOG_LEVEL);
+std::atomic<bool> Logger::running_(false);
+
+LogRing* Logger::ThreadRing()
+{
+  static thread_local ThreadRingHolder holder;
+  if (!holder.ring) {
+    static std::once_flag once;
+    std::call_once(once, []() {
+      running_.store(true);
+      atexit(&Logger::Stop);
+    });
+    holder.ring = Backend().Register();
+  }
+  return holder.ring.get();
+}
+
+void Logger::SetOutput(FILE* out)
+{
+  Backend().SetOutput(out);
+}
+
+void Logger::SetRingSize(size_t size)
+{
+  Backend().SetRingSize(size);
+}
+
+void Logger::Flush()
+{
+  Backend().Drain();
+}
+
+/// Runs at exit, whatever is logged afterwards is written in place
+void Logger::Stop()
+{
+  running_.store(false);
+  Backend().Stop();
+}
+
+int64_t Logger::NowMicros()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+}  // namespace evt_loop
@@ -1,85 +1,184 @@
 #include "message.h"
+#include "logger.h"
+#include <ctype.h>
+#include <algorithm>
 
 namespace evt_loop {
 
-const char* CRLFMessage::TERMINAL_LABEL = "\r\n";
-
+/// Scans for '\n' and checks the byte before it, which may be the last byte
+/// of the previous chunk, so a "\r\n" split across two reads is still found.
+/// Every byte is scanned once and the bounded scan never relies on a NUL.
 size_t CRLFMessage::AppendData(const char* data, uint32_t size) {
-  if (data == NULL || size == 0 || Completion())
+  if (data == NULL || size == 0 || complete_)
     return 0;
-  // FIXME: should processing the case that "\r\n" was splitted in two data
   size_t feed_size = size;
-  char* tl_ptr = (char*)strstr(data, TERMINAL_LABEL);
-  if (tl_ptr != NULL) {
-    tl_ptr += 2;
-    feed_size = tl_ptr - data;
+  const char* end = data + size;
+  const char* lf = data;
+  while ((lf = FindByte(lf, end - lf, '\n')) != NULL) {
+    bool cr = (lf > data) ? (lf[-1] == '\r') : (!data_.empty() && data_[data_.size() - 1] == '\r');
+    if (cr) {
+      feed_size = lf + 1 - data;
+      complete_ = true;
+      break;
+    }
+    lf++;
   }
   data_.append(data, feed_size);
   return feed_size;
 }
 size_t CRLFMessage::AssignData(const char* data, uint32_t size, bool has_hdr) {
   UNUSED(has_hdr);
-  data_.clear();
+  Clear();
   return AppendData(data, size);
 }
 
 size_t JsonMessage::AppendData(const char* data, uint32_t size) {
-  if (data == NULL || size == 0 || Completion())
+  static const char STRUCTURAL[] = { '{', '}', '[', ']', '"' };
+  static const char STRING_SPECIAL[] = { '"', '\\' };
+
+  if (data == NULL || size == 0 || complete_ || malformed_)
     return 0;
-  size_t feed_size = size;
-  for (uint32_t i = 0; i < size; i++) {
-    if (data[i] == '{') {
-      lbc_++;
-    } else if (data[i] == '}') {
-      rbc_++;
+  if (type_ == MessageType::NDJSON)
+    return AppendLine(data, size);
+
+  const char* p = data;
+  const char* end = data + size;
+  size_t skipped = 0;
+  if (!started_) {
+    while (p < end && isspace((unsigned char)*p)) p++;
+    skipped = p - data;
+    if (p == end) {
+      return skipped;
     }
-    if (lbc_ == rbc_) {
-      feed_size = i + 1;
+    if (*p != '{' && *p != '[' && *p != '"') {
+      malformed_ = true;
+      return skipped;
+    }
+    data = p;
+  }
+  size_t feed_size = end - data;
+  while (p < end) {
+    if (in_string_) {
+      if (escape_) {
+        escape_ = false;
+        p++;
+        continue;
+      }
+      p = FindAnyOf(p, end - p, STRING_SPECIAL, sizeof(STRING_SPECIAL));
+      if (p == NULL) break;
+      if (*p++ == '\\') {
+        escape_ = true;
+      } else {
+        in_string_ = false;
+        if (depth_ == 0) {  // a top-level string value
+          complete_ = true;
+        }
+      }
+    } else {
+      p = FindAnyOf(p, end - p, STRUCTURAL, sizeof(STRUCTURAL));
+      if (p == NULL) break;
+      switch (*p++) {
+        case '"':
+          in_string_ = started_ = true;
+          break;
+        case '{':
+        case '[':
+          depth_++;
+          started_ = true;
+          break;
+        default:  // '}' or ']'
+          if (depth_ > 0 && --depth_ == 0) {
+            complete_ = true;
+          }
+          break;
+      }
+    }
+    if (complete_) {
+      feed_size = p - data;
       break;
     }
   }
   data_.append(data, feed_size);
+  return skipped + feed_size;
+}
+
+/// JSON text can not hold a raw newline (not even in strings), so NDJSON
+/// only needs the line terminator
+size_t JsonMessage::AppendLine(const char* data, uint32_t size) {
+  const char* lf = FindByte(data, size, '\n');
+  size_t feed_size = (lf != NULL) ? (lf + 1 - data) : size;
+  for (size_t i = 0; i < feed_size && !started_; i++) {
+    started_ = !isspace((unsigned char)data[i]);
+  }
+  if (lf == NULL) {
+    data_.append(data, feed_size);
+  } else if (started_) {
+    data_.append(data, feed_size);
+    complete_ = true;
+  } else {
+    Message::Clear();  // drops a blank line
+  }
   return feed_size;
 }
+
 size_t JsonMessage::AssignData(const char* data, uint32_t size, bool has_hdr) {
   UNUSED(has_hdr);
-  data_.clear();
-  lbc_ = rbc_ = 0;
-  return AppendData(data, size);
+  Clear();
+  size_t feed_size = AppendData(data, size);
+  if (type_ == MessageType::NDJSON && !complete_ && started_) {
+    data_.push_back('\n');  // terminates the outgoing line
+    complete_ = true;
+  }
+  return feed_size;
 }
   
-BinaryMessage::BinaryMessage(const std::string& data, bool has_hdr) : Message(MessageType::BINARY) {
+BinaryMessage::BinaryMessage(const std::string& data, bool has_hdr) : Message(MessageType::BINARY), crc_(0) {
   AssignData(data.data(), data.size(), has_hdr);
   ResetHeader();
 }
-BinaryMessage::BinaryMessage(const char* data, uint32_t length, bool has_hdr) : Message(MessageType::BINARY) {
+BinaryMessage::BinaryMessage(const char* data, uint32_t length, bool has_hdr) : Message(MessageType::BINARY), crc_(0) {
   AssignData(data, length, has_hdr);
   ResetHeader();
 }
 BinaryMessage::BinaryMessage(const BinaryMessage& other) : Message(MessageType::BINARY) {
   data_ = other.data_;
+  crc_ = other.crc_;
   ResetHeader();
 }
 BinaryMessage& BinaryMessage::operator=(const BinaryMessage& rvalue) {
   data_ = rvalue.data_;
+  crc_ = rvalue.crc_;
   ResetHeader();
   return *this;
 }
 
+/// Takes the header first and then no more than the rest of the frame, so
+/// the caller can inspect the announced length before the payload arrives
 size_t BinaryMessage::AppendData(const char* data, uint32_t length) {
-  if (data == NULL || length == 0) return 0;
+  if (data == NULL || length == 0 || Completion()) return 0;
 
-  data_.append(data, length);
+  size_t feed_size = std::min(MoreSize(), (size_t)length);
+  data_.append(data, feed_size);
 
-  if (hdr_ == NULL && data_.size() >= sizeof(HDR)) {
+  if (hdr_ == NULL) {
+    if (data_.size() < sizeof(HDR)) return feed_size;
     hdr_ = (HDR*)data_.data();
-    printf("[BinaryMessage::AppendData] HDR: %s\n", hdr_->ToString().c_str());
-    if (data_.capacity() < hdr_->length) {
-      data_.reserve(hdr_->length);
-      hdr_ = (HDR*)data_.data();
+    EL_LOG_DEBUG("[BinaryMessage::AppendData] HDR: %s", hdr_->ToString().c_str());
+    if (hdr_->length < sizeof(HDR)) {
+      hdr_->length = sizeof(HDR);   // a corrupt length is taken as an empty message
     }
+    /// The length is untrusted, large payloads grow the buffer as they arrive
+    data_.reserve(std::min((size_t)hdr_->length, (size_t)MAX_UPFRONT_RESERVE));
   }
-  return length;   // FIXME: the return value maybe less than length
+  hdr_ = (HDR*)data_.data();
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+  /// Header bytes are never fed together with payload bytes, so past the
+  /// header everything fed here is payload
+  if ((hdr_->flags & FLAG_CHECKSUM) && data_.size() > sizeof(HDR)) {
+    crc_ = Crc32c(data, feed_size, crc_);
+  }
+#endif
+  return feed_size;
 }
 
 size_t BinaryMessage::AssignData(const char* data, uint32_t length, bool has_hdr) {
@@ -119,17 +218,64 @@ size_t BinaryMessage::MoreSize() const {
   return more_size;
 }
 
+size_t TLVMessage::MoreSize() const {
+  const TlvHeader* hdr = Header();
+  if (hdr == NULL) {
+    return sizeof(TlvHeader) - data_.size();
+  }
+  return sizeof(TlvHeader) + hdr->length - data_.size();
+}
+
+/// Takes the header first and then no more than the rest of the current record
+size_t TLVMessage::AppendData(const char* data, uint32_t length) {
+  if (data == NULL || length == 0 || Completion()) return 0;
+  size_t feed_size = std::min(MoreSize(), (size_t)length);
+  data_.append(data, feed_size);
+  if (data_.size() == sizeof(TlvHeader)) {  // the header has just completed
+    data_.reserve(std::min(ExpectedSize(), (size_t)MAX_UPFRONT_RESERVE));
+  }
+  return feed_size;
+}
+
+size_t TLVMessage::AssignData(const char* data, uint32_t length, bool has_hdr) {
+  if (!has_hdr) {
+    return Assign(DEFAULT_TAG, data, length);
+  }
+  Clear();
+  return AppendData(data, length);
+}
+
+size_t TLVMessage::Assign(uint16_t tag, const char* value, uint32_t length) {
+  Clear();
+  TlvHeader hdr;
+  hdr.tag = tag;
+  hdr.length = length;
+  data_.reserve(sizeof(hdr) + length);
+  data_.append((const char*)&hdr, sizeof(hdr));
+  data_.append(value, length);
+  return length;
+}
+
+/// Messages come from per-thread pools, so the steady state receive and send
+/// paths reuse objects, reference counts and payload buffers instead of
+/// allocating them.
 MessagePtr CreateMessage(MessageType msg_type) {
   MessagePtr msg_ptr;
   switch (msg_type) {
     case MessageType::CRLF:
-      msg_ptr = std::make_shared<CRLFMessage>();
+      msg_ptr = ObjectPool<CRLFMessage>::Instance().Acquire();
       break;
     case MessageType::JSON:
-      msg_ptr = std::make_shared<JsonMessage>();
+      msg_ptr = ObjectPool<JsonMessage>::Instance().Acquire();
+      break;
+    case MessageType::NDJSON:
+      msg_ptr = ObjectPool<NdJsonMessage>::Instance().Acquire();
+      break;
+    case MessageType::TLV:
+      msg_ptr = ObjectPool<TLVMessage>::Instance().Acquire();
       break;
     case MessageType::BINARY:
-      msg_ptr = std::make_shared<BinaryMessage>();
+      msg_ptr = ObjectPool<BinaryMessage>::Instance().Acquire();
       break;
     default:
       break;
@@ -138,34 +284,35 @@ MessagePtr CreateMessage(MessageType msg_type) {
 }
 
 MessagePtr CreateMessage(MessageType msg_type, const char* data, size_t length, bool bmsg_has_no_hdr) {
-  MessagePtr msg_ptr;
-  switch (msg_type) {
-    case MessageType::CRLF:
-      msg_ptr = std::make_shared<CRLFMessage>(data, length);
-      break;
-    case MessageType::JSON:
-      msg_ptr = std::make_shared<JsonMessage>(data, length);
-      break;
-    case MessageType::BINARY:
-      msg_ptr = std::make_shared<BinaryMessage>(data, length, bmsg_has_no_hdr);
-      break;
-    default:
-      break;
+  MessagePtr msg_ptr = CreateMessage(msg_type);
+  if (msg_ptr) {
+    msg_ptr->AssignData(data, length, bmsg_has_no_hdr);
+    if (msg_type == MessageType::BINARY) {
+      static_cast<BinaryMessage*>(msg_ptr.get())->ResetHeader();
+    }
   }
   return msg_ptr;
 }
 
+/// The type tag is checked by the switch, so static_cast is safe here
 MessagePtr CreateMessage(const Message& msg) {
-  MessagePtr msg_ptr;
+  MessagePtr msg_ptr = CreateMessage(msg.Type());
   switch (msg.Type()) {
     case MessageType::CRLF:
-      msg_ptr = std::make_shared<CRLFMessage>(dynamic_cast<const CRLFMessage&>(msg));
+      *static_cast<CRLFMessage*>(msg_ptr.get()) = static_cast<const CRLFMessage&>(msg);
       break;
     case MessageType::JSON:
-      msg_ptr = std::make_shared<JsonMessage>(dynamic_cast<const JsonMessage&>(msg));
+    case MessageType::NDJSON:
+      *static_cast<JsonMessage*>(msg_ptr.get()) = static_cast<const JsonMessage&>(msg);
       break;
     case MessageType::BINARY:
-      msg_ptr = std::make_shared<BinaryMessage>(dynamic_cast<const BinaryMessage&>(msg));
+      *static_cast<BinaryMessage*>(msg_ptr.get()) = static_cast<const BinaryMessage&>(msg);
+      break;
+    case MessageType::TLV:
+      *static_cast<TLVMessage*>(msg_ptr.get()) = static_cast<const TLVMessage&>(msg);
+      break;
+    case MessageType::CUSTOM:
+      msg_ptr = msg.Clone();
       break;
     default:
       break;
@@ -173,33 +320,49 @@ MessagePtr CreateMessage(const Message& msg) {
   return msg_ptr;
 }
 
+MessagePtr CreateMessage(const Framing& framing, const char* data, size_t length, bool has_hdr) {
+  MessagePtr msg_ptr;
+  if (framing.Valid()) {
+    msg_ptr = framing.create();
+    msg_ptr->AssignData(data, length, has_hdr);
+  }
+  return msg_ptr;
+}
+
 MessagePtr& MessageMQ::Last() {
   if (mq_.empty()) {
-    mq_.push(CreateMessage(msg_type_));
+    mq_.push(NewMessage());
   }
   return mq_.back();
 }
 MessagePtr& MessageMQ::First() {
   if (mq_.empty()) {
-    mq_.push(CreateMessage(msg_type_));
+    mq_.push(NewMessage());
   }
   return mq_.front();
 }
-void MessageMQ::AppendData(const char* data, uint32_t size) {
+size_t MessageMQ::AppendData(const char* data, uint32_t size) {
   size_t feeds = 0;
   while (feeds < size) {
     if (Last()->Completion()) {
-      mq_.push(CreateMessage(msg_type_));
+      mq_.push(NewMessage());
     }
-    feeds += Last()->AppendData(&data[feeds], size - feeds);
-    if (Last()->Completion()) {
-      printf("[MessageMQ] Recieved a complation message, type: %d, size: %lu\n", Last()->Type(), Last()->Size());
+    MessagePtr& last = Last();
+    size_t taken = last->AppendData(&data[feeds], size - feeds);
+    feeds += taken;
+    if (last->Completion()) {
+      EL_LOG_DEBUG("[MessageMQ] Recieved a complation message, type: %d, size: %lu", last->Type(), last->Size());
+    } else if (taken == 0 || last->Malformed()) {
+      break;   // the stream is corrupt, the caller finds out from Last()
+    } else if (size_limit_ > 0 && std::max(last->ExpectedSize(), last->Size()) > size_limit_) {
+      break;   // unframed formats count what they have buffered
     }
   }
+  return feeds;
 }
 void MessageMQ::Apply(MessageDispatcher& cb) {
   while (!mq_.empty() && mq_.front()->Completion()) {
-    cb(mq_.front().get());
+    cb(mq_.front());  // the dispatcher may take the message over
     mq_.pop();
   }
 }
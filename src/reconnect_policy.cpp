@@ -0,0 +1,78 @@
+#include "reconnect_policy.h"
+#include <algorithm>
+#include <random>
+
+#define DEFAULT_BASE_DELAY_MS   1000
+#define DEFAULT_MAX_DELAY_MS    30000
+#define DEFAULT_STABLE_MS       5000
+
+namespace evt_loop {
+
+/// Seeded per thread, so processes started together do not draw alike
+static uint32_t RandomUpTo(uint32_t max)
+{
+    static thread_local std::mt19937 rng(std::random_device{}());
+    return std::uniform_int_distribution<uint32_t>(0, max)(rng);
+}
+
+ReconnectPolicy::ReconnectPolicy() :
+    base_delay_ms(DEFAULT_BASE_DELAY_MS), max_delay_ms(DEFAULT_MAX_DELAY_MS), multiplier(2.0),
+    full_jitter(true), max_attempts(0), stable_ms(DEFAULT_STABLE_MS)
+{ }
+
+ReconnectPolicy ReconnectPolicy::Fixed(uint32_t delay_ms, uint32_t max_attempts)
+{
+    ReconnectPolicy policy;
+    policy.base_delay_ms = delay_ms;
+    policy.max_delay_ms = delay_ms;
+    policy.multiplier = 1.0;
+    policy.full_jitter = false;
+    policy.max_attempts = max_attempts;
+    return policy;
+}
+
+bool ReconnectBackoff::NextDelay(uint32_t& delay_ms)
+{
+    if (policy_.max_attempts > 0 && stats_.consecutive_failures >= policy_.max_attempts) {
+        stats_.give_ups++;
+        stats_.consecutive_failures = 0;    // a later Reconnect() starts over
+        return false;
+    }
+    double delay = policy_.base_delay_ms;
+    for (uint32_t i = 0; i < stats_.consecutive_failures && delay < policy_.max_delay_ms; i++) {
+        delay *= std::max(policy_.multiplier, 1.0);
+    }
+    delay_ms = (uint32_t)std::min(delay, (double)policy_.max_delay_ms);
+    if (policy_.full_jitter) {
+        delay_ms = RandomUpTo(delay_ms);
+    }
+    if (delay_ms == 0) {
+        delay_ms = 1;   // a timer due at once would be run in the same pass of the loop
+    }
+    stats_.attempts++;
+    stats_.consecutive_failures++;
+    stats_.last_delay_ms = delay_ms;
+    return true;
+}
+
+void ReconnectBackoff::OnConnected()
+{
+    if (stats_.consecutive_failures > 0) {
+        stats_.reconnects++;
+    }
+    connected_ = true;
+    connected_at_ = TimeVal::Now();
+}
+
+void ReconnectBackoff::OnDisconnected()
+{
+    if (!connected_) {
+        return;
+    }
+    connected_ = false;
+    if (TimeVal::MsDiff(TimeVal::Now(), connected_at_) >= (int32_t)policy_.stable_ms) {
+        stats_.consecutive_failures = 0;
+    }
+}
+
+}  // namespace evt_loop
@@ -1,4 +1,5 @@
 #include "session_mngr.h"
+#include "logger.h"
 
 namespace evt_loop {
 
@@ -59,7 +60,7 @@ void SessionManager::RemoveSession(SessionID sid)
 }
 void SessionManager::CheckSessionTimeoutCb(PeriodicTimer* timer)
 {
-    printf("Session timeout checking on timer, now: %lu.\n", Now());
+    EL_LOG_DEBUG("Session timeout checking on timer, now: %lu.", Now());
     for (auto iter = m_sess_timeout_map.begin(); iter != m_sess_timeout_map.end();)
     {
         time_t create_time = iter->first;
@@ -72,7 +73,7 @@ void SessionManager::CheckSessionTimeoutCb(PeriodicTimer* timer)
             auto iter_rm = iter++;
             m_sess_timeout_map.erase(iter_rm);
             m_session_map.erase(sess_ptr->sid);
-            printf("[SessionManager::CheckSessionTimeoutCb] Session timeout in %d seconds, dissconnect by server", m_timeout);
+            EL_LOG_INFO("[SessionManager::CheckSessionTimeoutCb] Session timeout in %d seconds, dissconnect by server", m_timeout);
         }
         else
         {
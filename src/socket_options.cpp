@@ -0,0 +1,121 @@
+#include "socket_options.h"
+#include "logger.h"
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace evt_loop {
+
+static bool IsTcp(int fd)
+{
+    int domain = AF_UNSPEC;
+    socklen_t len = sizeof(domain);
+    getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len);
+    return domain == AF_INET || domain == AF_INET6;
+}
+
+static bool SetOption(int fd, int level, int name, int value, const char* option)
+{
+    if (value < 0) {
+        return true;
+    }
+    if (setsockopt(fd, level, name, &value, sizeof(value)) == -1) {
+        EL_LOG_WARN("[SocketOptions] %s = %d refused, fd: %d, error: %s", option, value, fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+SocketOptions::SocketOptions() :
+    tcp_nodelay(-1), tcp_quickack(-1), sndbuf(-1), rcvbuf(-1), notsent_lowat(-1), defer_accept(-1),
+    fastopen(-1), keepalive(-1), keepidle(-1), keepintvl(-1), keepcnt(-1), busy_poll(-1)
+{ }
+
+SocketOptions SocketOptions::LowLatency()
+{
+    SocketOptions opts;
+    opts.tcp_nodelay = 1;
+    opts.tcp_quickack = 1;
+    opts.notsent_lowat = 16 * 1024;
+    return opts;
+}
+
+SocketOptions SocketOptions::Bulk()
+{
+    SocketOptions opts;
+    opts.sndbuf = 4 * 1024 * 1024;
+    opts.rcvbuf = 4 * 1024 * 1024;
+    return opts;
+}
+
+SocketOptions SocketOptions::Wan()
+{
+    SocketOptions opts;
+    opts.tcp_nodelay = 1;
+    opts.notsent_lowat = 128 * 1024;
+    opts.fastopen = 256;
+    opts.keepalive = 1;
+    opts.keepidle = 30;
+    opts.keepintvl = 10;
+    opts.keepcnt = 6;
+    return opts;
+}
+
+bool SocketOptions::FromProfile(const string& name, SocketOptions& opts)
+{
+    if (name == "default") {
+        opts = SocketOptions();
+    } else if (name == "low-latency") {
+        opts = LowLatency();
+    } else if (name == "bulk") {
+        opts = Bulk();
+    } else if (name == "wan") {
+        opts = Wan();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/// The window scale offered to a client follows the receive buffer of the
+/// listener at the time of its SYN
+bool SocketOptions::ApplyListener(int fd) const
+{
+    bool ok = ApplyConnection(fd);
+    if (IsTcp(fd)) {
+        ok &= SetOption(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, defer_accept, "TCP_DEFER_ACCEPT");
+        ok &= SetOption(fd, IPPROTO_TCP, TCP_FASTOPEN, fastopen, "TCP_FASTOPEN");
+    }
+    return ok;
+}
+
+/// TCP_FASTOPEN_CONNECT is left off: connect() would succeed before any
+/// handshake, and a non-blocking connect could no longer learn its outcome
+bool SocketOptions::ApplyClient(int fd) const
+{
+    return ApplyConnection(fd);
+}
+
+bool SocketOptions::ApplyConnection(int fd) const
+{
+    bool ok = true;
+    ok &= SetOption(fd, SOL_SOCKET, SO_SNDBUF, sndbuf, "SO_SNDBUF");
+    ok &= SetOption(fd, SOL_SOCKET, SO_RCVBUF, rcvbuf, "SO_RCVBUF");
+    if (!IsTcp(fd)) {
+        return ok;
+    }
+    ok &= SetOption(fd, IPPROTO_TCP, TCP_NODELAY, tcp_nodelay, "TCP_NODELAY");
+    ok &= SetOption(fd, IPPROTO_TCP, TCP_QUICKACK, tcp_quickack, "TCP_QUICKACK");
+    ok &= SetOption(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, notsent_lowat, "TCP_NOTSENT_LOWAT");
+    ok &= SetOption(fd, SOL_SOCKET, SO_KEEPALIVE, keepalive, "SO_KEEPALIVE");
+    if (keepalive > 0) {
+        ok &= SetOption(fd, IPPROTO_TCP, TCP_KEEPIDLE, keepidle, "TCP_KEEPIDLE");
+        ok &= SetOption(fd, IPPROTO_TCP, TCP_KEEPINTVL, keepintvl, "TCP_KEEPINTVL");
+        ok &= SetOption(fd, IPPROTO_TCP, TCP_KEEPCNT, keepcnt, "TCP_KEEPCNT");
+    }
+    ok &= SetOption(fd, SOL_SOCKET, SO_BUSY_POLL, busy_poll, "SO_BUSY_POLL");
+    return ok;
+}
+
+}  // namespace evt_loop
@@ -1,12 +1,16 @@
 #include "tcp_client.h"
 #include "eventloop.h"
+#include "logger.h"
 #include <unistd.h>
 
 namespace evt_loop {
 
 TcpClient::TcpClient(const char *host, uint16_t port, MessageType msg_type, bool auto_reconnect, TcpCallbacksPtr tcp_evt_cbs)
-    : msg_type_(msg_type), auto_reconnect_(auto_reconnect), conn_(nullptr),
+    : IOEvent(-1, IOEvent::WRITE | IOEvent::ERROR | IOEvent::NONBLOCK),
+    msg_type_(msg_type), auto_reconnect_(auto_reconnect), conn_(nullptr),
     reconnect_timer_(std::bind(&TcpClient::OnReconnectTimer, this, std::placeholders::_1)),
+    connecting_(false), connect_timeout_ms_(DEFAULT_CONNECT_TIMEOUT_MS),
+    connect_timer_(std::bind(&TcpClient::OnConnectTimer, this, std::placeholders::_1)),
     tcp_evt_cbs_(tcp_evt_cbs)
 {
     server_addr_.port_ = port;
@@ -18,13 +22,6 @@ TcpClient::TcpClient(const char *host, uint16_t port, MessageType msg_type, bool
         server_addr_.ip_ = host;
     }
 
-    if (auto_reconnect_) {
-        timeval tv;
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
-        reconnect_timer_.SetInterval(tv);
-    }
-
     Connect();
 }
 
@@ -43,16 +40,33 @@ bool TcpClient::Connect()
 
 void TcpClient::Disconnect()
 {
+    if (connecting_) {
+        close(StopConnecting());
+    }
     if (conn_) {
         //delete conn_;
         conn_ = nullptr;
     }
 }
 
+/// Schedules one attempt, each failure schedules the next one further out
 void TcpClient::Reconnect()
 {
-    if (!reconnect_timer_.IsRunning())
-      reconnect_timer_.Start();
+    if (reconnect_timer_.IsRunning() || connecting_)
+        return;
+    uint32_t delay_ms = 0;
+    if (!backoff_.NextDelay(delay_ms)) {
+        OnError(ECONNABORTED, "reconnect attempts exhausted");
+        return;
+    }
+    EL_LOG_INFO("[TcpClient::Reconnect] attempt %u in %u ms", backoff_.Stats().consecutive_failures, delay_ms);
+    reconnect_timer_.SetIntervalMs(delay_ms);
+    reconnect_timer_.Start();
+}
+
+void TcpClient::SetReconnectPolicy(const ReconnectPolicy& policy)
+{
+    backoff_.SetPolicy(policy);
 }
 
 bool TcpClient::Send(const string& msg)
@@ -72,17 +86,53 @@ void TcpClient::SetTcpCallbacks(const TcpCallbacksPtr& tcp_evt_cbs)
     if (conn_) conn_->SetTcpCallbacks(tcp_evt_cbs_);
 }
 
-void TcpClient::OnConnected(int fd, const IPAddress& local_addr)
+void TcpClient::SetFraming(const Framing& framing)
+{
+    msg_type_ = MessageType::CUSTOM;
+    framing_ = framing;
+    if (conn_) conn_->SetFraming(framing_);
+}
+
+void TcpClient::SetSocketOptions(const SocketOptions& opts)
+{
+    sock_opts_ = opts;
+    if (conn_) {
+        sock_opts_.ApplyConnection(conn_->FD());
+        conn_->SetQuickAck(sock_opts_.tcp_quickack > 0);
+    }
+}
+
+void TcpClient::SetConnectTimeout(uint32_t timeout_ms)
+{
+    connect_timeout_ms_ = timeout_ms;
+    if (connecting_) {
+        if (connect_timer_.IsRunning()) connect_timer_.Stop();
+        if (connect_timeout_ms_ > 0) {
+            connect_timer_.SetIntervalMs(connect_timeout_ms_);
+            connect_timer_.Start();
+        }
+    }
+}
+
+void TcpClient::OnConnected(int fd, const SockAddr& local_addr, const SockAddr& peer_addr)
 {
-    conn_ = std::make_shared<TcpConnection>(fd, local_addr, server_addr_,
-        std::bind(&TcpClient::OnConnectionClosed, this, std::placeholders::_1), tcp_evt_cbs_);
-    conn_->SetMessageType(msg_type_);
+    conn_ = std::make_shared<TcpConnection>(fd, local_addr, peer_addr,
+        std::bind(&TcpClient::OnConnectionClosed, this, std::placeholders::_1), tcp_evt_cbs_,
+        IOEvent::READ | IOEvent::ERROR | IOEvent::NONBLOCK);
+    if (framing_.Valid()) {
+        conn_->SetFraming(framing_);
+    } else {
+        conn_->SetMessageType(msg_type_);
+    }
+    if (sock_opts_.tcp_quickack > 0) conn_->SetQuickAck(true);
+    backoff_.OnConnected();
     SendTempBuffer();
     if (tcp_evt_cbs_) tcp_evt_cbs_->on_new_client_cb(conn_.get());
 }
 
 void TcpClient::OnConnectionClosed(TcpConnection* conn)
 {
+    backoff_.OnDisconnected();
     //delete conn_;
     conn_ = nullptr;
     if (auto_reconnect_) {
@@ -90,37 +140,111 @@ void TcpClient::OnConnectionClosed(TcpConnection* conn)
     }
 }
 
+/// The socket connects in the background, its write readiness reports the
+/// outcome to OnEvents() unless the deadline passes first
 bool TcpClient::Connect_()
 {
-    int fd;
-    sockaddr_in sock_addr;
+    if (connecting_) {
+        return true;
+    }
+    struct sockaddr_storage sock_addr;
+    socklen_t addr_len = 0;
+    if (!IPAddressToSocketAddr(server_addr_, sock_addr, addr_len)) {
+        OnError(EINVAL, "invalid server address");
+        return false;
+    }
 
-    fd = socket(AF_INET, SOCK_STREAM, 0);
-    sock_addr.sin_family = PF_INET;
-    sock_addr.sin_port = htons(server_addr_.port_);
-    inet_aton(server_addr_.ip_.c_str(), &sock_addr.sin_addr);
+    int fd = socket(sock_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        OnError(errno, strerror(errno));
+        return false;
+    }
     int reuseaddr = 1;
-    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr)) == -1) {
+    if (sock_addr.ss_family != AF_UNIX && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr)) == -1) {
         OnError(errno, strerror(errno));
         close(fd);
         return false;
     }
+    sock_opts_.ApplyClient(fd);
 
-    if (connect(fd, (sockaddr*)&sock_addr, sizeof(sockaddr_in)) == -1) {
+    peer_addr_ = SockAddr((sockaddr*)&sock_addr, addr_len);
+    int ret = connect(fd, (sockaddr*)&sock_addr, addr_len);
+    if (ret == 0 && sock_addr.ss_family == AF_UNIX) {
+        FinishConnect(fd);  // unix sockets connect at once
+        return true;
+    }
+    /// A TCP connect reported done at once is still confirmed by SO_ERROR
+    if (ret == -1 && errno != EINPROGRESS) {
         OnError(errno, strerror(errno));
         close(fd);
         return false;
     }
-    IPAddress local_addr;
-    SocketAddrToIPAddress(sock_addr, local_addr);
-    OnConnected(fd, local_addr);
-
+    connecting_ = true;
+    IOEvent::SetFD(fd);
+    if (connect_timeout_ms_ > 0) {
+        connect_timer_.SetIntervalMs(connect_timeout_ms_);
+        connect_timer_.Start();
+    }
     return true;
 }
 
+void TcpClient::OnEvents(uint32_t events)
+{
+    if (!connecting_) {
+        return;
+    }
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+        err = errno;
+    }
+    int fd = StopConnecting();
+    if (err != 0) {
+        close(fd);
+        OnConnectFailed(err, strerror(err));
+        return;
+    }
+    FinishConnect(fd);
+}
+
+void TcpClient::FinishConnect(int fd)
+{
+    struct sockaddr_storage local_sock_addr;
+    socklen_t local_len = sizeof(local_sock_addr);
+    getsockname(fd, (sockaddr*)&local_sock_addr, &local_len);
+    OnConnected(fd, SockAddr((sockaddr*)&local_sock_addr, local_len), peer_addr_);
+}
+
+/// Hands the socket of the connect under way back, the loop no longer watches it
+int TcpClient::StopConnecting()
+{
+    int fd = fd_;
+    connecting_ = false;
+    if (connect_timer_.IsRunning()) connect_timer_.Stop();
+    IOEvent::SetFD(-1);
+    return fd;
+}
+
+void TcpClient::OnConnectFailed(int errcode, const char* errstr)
+{
+    OnError(errcode, errstr);
+    if (auto_reconnect_) {
+        Reconnect();
+    }
+}
+
+void TcpClient::OnConnectTimer(PeriodicTimer* timer)
+{
+    timer->Stop();
+    if (connecting_) {
+        close(StopConnecting());
+        OnConnectFailed(ETIMEDOUT, "connect timed out");
+    }
+}
+
 void TcpClient::OnError(int errcode, const char* errstr)
 {
-    printf("[TcpClient::OnError] error code: %d, error string: %s\n", errcode, errstr);
+    EL_LOG_ERROR("[TcpClient::OnError] error code: %d, error string: %s", errcode, errstr);
     if (tcp_evt_cbs_) tcp_evt_cbs_->on_error_cb(errcode, errstr);
 }
 
@@ -137,15 +261,12 @@ void TcpClient::SendTempBuffer()
 
 void TcpClient::OnReconnectTimer(PeriodicTimer* timer)
 {
-    if (!conn_) {  // if the connection is not created, then reconnect
-        bool success = Connect_();
-        if (success) {
-            timer->Stop();
-        } else {
-            printf("[TcpClient::ReconnectTimer::OnReconnectTimer] Reconnect failed, retry %u seconds later...\n", timer->GetInterval().Seconds());
+    timer->Stop();
+    if (!conn_ && !connecting_) {  // if the connection is not created, then reconnect
+        if (!Connect_()) {
+            EL_LOG_WARN("[TcpClient::OnReconnectTimer] Reconnect failed");
+            Reconnect();
         }
-    } else {
-        timer->Stop();
     }
 }
 
@@ -1,26 +1,31 @@
 #include "eventloop.h"
 #include "tcp_connection.h"
+#include "tcp_relay.h"
+#include "logger.h"
 #include <unistd.h>
+#include <netinet/tcp.h>
+#include <algorithm>
 
 namespace evt_loop {
 
-TcpConnection::TcpConnection(int fd, const IPAddress& local_addr, const IPAddress& peer_addr,
-    const OnClosedCallback& close_cb, TcpCallbacksPtr tcp_evt_cbs) :
-  BufferIOEvent(fd), id_(0), local_addr_(local_addr), peer_addr_(peer_addr),
-  creator_notification_cb_(close_cb), tcp_evt_cbs_(tcp_evt_cbs)
+TcpConnection::TcpConnection(int fd, const SockAddr& local_addr, const SockAddr& peer_addr,
+    const OnClosedCallback& close_cb, TcpCallbacksPtr tcp_evt_cbs, uint32_t events) :
+  BufferIOEvent(fd, events), id_(0), local_addr_(local_addr), peer_addr_(peer_addr), quickack_(false),
+  creator_notification_cb_(close_cb), tcp_evt_cbs_(tcp_evt_cbs), relay_(NULL)
 {
-    printf("[TcpConnection::TcpConnection] local_addr: %s, peer_addr: %s\n",
+    EL_LOG_INFO("[TcpConnection::TcpConnection] local_addr: %s, peer_addr: %s",
         local_addr_.ToString().c_str(), peer_addr_.ToString().c_str());
 }
 
 TcpConnection::~TcpConnection()
 {
+    if (relay_) relay_->OnConnectionDestroyed(this);
     Destroy();
 }
 
 void TcpConnection::Destroy()
 {
-    printf("[TcpConnection::Destroy] id: %d, fd: %d\n", id_, fd_);
+    EL_LOG_DEBUG("[TcpConnection::Destroy] id: %d, fd: %d", id_, fd_);
     if (fd_ >= 0) {
         EV_Singleton->DeleteEvent(this);
         close(fd_);
@@ -28,6 +33,34 @@ void TcpConnection::Destroy()
     }
 }
 
+IPAddress TcpConnection::GetLocalAddr() const
+{
+    if (local_addr_.Family() != AF_UNIX || fd_ < 0) {
+        return local_addr_.ToIPAddress();
+    }
+    IPAddress ip_addr;
+    struct sockaddr_storage sock_addr;
+    socklen_t len = sizeof(sock_addr);
+    if (getsockname(fd_, (struct sockaddr*)&sock_addr, &len) == 0) {
+        SocketAddrToIPAddress((struct sockaddr*)&sock_addr, len, ip_addr);
+    }
+    return ip_addr;
+}
+
+IPAddress TcpConnection::GetPeerAddr() const
+{
+    if (peer_addr_.Family() != AF_UNIX || fd_ < 0) {
+        return peer_addr_.ToIPAddress();
+    }
+    IPAddress ip_addr;
+    struct sockaddr_storage sock_addr;
+    socklen_t len = sizeof(sock_addr);
+    if (getpeername(fd_, (struct sockaddr*)&sock_addr, &len) == 0) {
+        SocketAddrToIPAddress((struct sockaddr*)&sock_addr, len, ip_addr);
+    }
+    return ip_addr;
+}
+
 void TcpConnection::SetTcpCallbacks(const TcpCallbacksPtr& tcp_evt_cbs)
 {
     tcp_evt_cbs_ = tcp_evt_cbs;
@@ -38,14 +71,39 @@ void TcpConnection::Disconnect()
     OnClosed();
 }
 
-const IPAddress& TcpConnection::GetLocalAddr() const
+int TcpConnection::Detach(string& pending, size_t max_pending)
 {
-    return local_addr_;
+    if (fd_ < 0 || relay_ || !IsIdle()) {
+        return -1;
+    }
+    pending.clear();
+    TakeRxBuffer(pending);
+    if (max_pending > 0 && pending.size() > max_pending) {
+        FeedRxBuffer(pending.data(), pending.size());   // framed up to the same point again
+        pending.clear();
+        return -1;
+    }
+    /// The application lets go of it as of a closed connection (groups,
+    /// upstream links), the fd is still valid during the callback
+    if (tcp_evt_cbs_) tcp_evt_cbs_->on_closed_cb(this);
+    int fd = fd_;
+    SetFD(-1);
+    EL_LOG_INFO("[TcpConnection::Detach] id: %d, fd: %d, pending: %lu", id_, fd, pending.size());
+    return fd;
 }
 
-const IPAddress& TcpConnection::GetPeerAddr() const
+void TcpConnection::OnEvents(uint32_t events)
 {
-    return peer_addr_;
+    /// A relayed connection moves raw bytes, the message framers are bypassed
+    if (relay_) {
+        relay_->OnEvents(this, events);
+        return;
+    }
+    if (quickack_ && (events & IOEvent::READ)) {
+        int on = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+    }
+    BufferIOEvent::OnEvents(events);
 }
 
 void TcpConnection::OnReceived(const Message* msg)
@@ -53,23 +111,111 @@ void TcpConnection::OnReceived(const Message* msg)
     if (tcp_evt_cbs_) tcp_evt_cbs_->on_msg_recvd_cb(this, msg);
 }
 
+void TcpConnection::OnReceivedMessage(MessagePtr& msg)
+{
+    if (tcp_evt_cbs_ && tcp_evt_cbs_->on_msg_recvd_ptr_cb) {
+        tcp_evt_cbs_->on_msg_recvd_ptr_cb(this, msg);
+    } else {
+        OnReceived(msg.get());
+    }
+}
+
+void TcpConnection::OnReceivedBatch(std::vector<MessagePtr>& msgs)
+{
+    if (tcp_evt_cbs_ && tcp_evt_cbs_->on_msgs_recvd_cb) {
+        rx_views_.clear();
+        for (size_t i = 0; i < msgs.size(); i++) {
+            rx_views_.push_back(msgs[i].get());
+        }
+        tcp_evt_cbs_->on_msgs_recvd_cb(this, rx_views_.data(), rx_views_.size());
+    } else {
+        BufferIOEvent::OnReceivedBatch(msgs);
+    }
+}
+
+void TcpConnection::OnReceivedChunk(const MessageChunk& chunk)
+{
+    if (tcp_evt_cbs_ && tcp_evt_cbs_->on_msg_chunk_cb) tcp_evt_cbs_->on_msg_chunk_cb(this, chunk);
+}
+
 void TcpConnection::OnSent(const Message* msg)
 {
     if (tcp_evt_cbs_) tcp_evt_cbs_->on_msg_sent_cb(this, msg);
 }
 
+void TcpConnection::OnHighWatermark(size_t queued)
+{
+    EL_LOG_WARN("[TcpConnection::OnHighWatermark] fd: %d, queued: %lu", fd_, queued);
+    if (tcp_evt_cbs_ && tcp_evt_cbs_->on_high_watermark_cb) tcp_evt_cbs_->on_high_watermark_cb(this, queued);
+}
+
+void TcpConnection::OnLowWatermark(size_t queued)
+{
+    EL_LOG_INFO("[TcpConnection::OnLowWatermark] fd: %d, queued: %lu", fd_, queued);
+    if (tcp_evt_cbs_ && tcp_evt_cbs_->on_low_watermark_cb) tcp_evt_cbs_->on_low_watermark_cb(this, queued);
+}
+
 void TcpConnection::OnClosed()
 {
-    printf("[TcpConnection::OnClosed] client leave, fd: %d\n", fd_);
+    EL_LOG_INFO("[TcpConnection::OnClosed] client leave, fd: %d", fd_);
     if (tcp_evt_cbs_) tcp_evt_cbs_->on_closed_cb(this);
     creator_notification_cb_(this);
 }
 
 void TcpConnection::OnError(int errcode, const char* errstr)
 {
-    printf("[TcpConnection::OnError] error string: %s\n", errstr);
+    EL_LOG_ERROR("[TcpConnection::OnError] error string: %s", errstr);
     if (tcp_evt_cbs_) tcp_evt_cbs_->on_error_cb(errcode, errstr);
     //OnClosed();
 }
 
+bool TcpConnectionTable::Insert(int fd, const TcpConnectionPtr& conn)
+{
+    if (fd < 0 || !conn) return false;
+    if ((size_t)fd >= slots_.size()) {
+        slots_.resize(std::max((size_t)fd + 1, slots_.size() * 2));
+    }
+    if (slots_[fd]) return false;
+    slots_[fd] = conn;
+    count_++;
+    return true;
+}
+
+void TcpConnectionTable::Erase(int fd)
+{
+    if (fd < 0 || (size_t)fd >= slots_.size() || !slots_[fd]) return;
+    TcpConnectionPtr conn;
+    conn.swap(slots_[fd]);
+    count_--;
+}
+
+void TcpConnectionTable::Clear()
+{
+    std::vector<TcpConnectionPtr> slots;
+    slots.swap(slots_);
+    count_ = 0;
+}
+
+/// The message is framed once, every member queues a reference to the same buffer
+size_t ConnectionGroup::Broadcast(const Message& msg)
+{
+    return Broadcast(CreateMessage(msg));
+}
+
+size_t ConnectionGroup::Broadcast(const char* data, uint32_t len)
+{
+    if (framing_.Valid()) return Broadcast(CreateMessage(framing_, data, len));
+    return Broadcast(CreateMessage(msg_type_, data, len));
+}
+
+size_t ConnectionGroup::Broadcast(const MessagePtr& msg)
+{
+    if (!msg) return 0;
+    std::set<TcpConnection*>::iterator iter;
+    for (iter = conns_.begin(); iter != conns_.end(); ++iter) {
+        (*iter)->SendShared(msg);
+    }
+    return conns_.size();
+}
+
 }  // namespace evt_loop
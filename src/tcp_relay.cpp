@@ -0,0 +1,267 @@
+#include "eventloop.h"
+#include "tcp_relay.h"
+#include "logger.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define RELAY_PIPE_SIZE         (1 << 16)
+#define RELAY_SPLICE_FLAGS      (SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+#define RELAY_CLOSE_DELAY_US    1000    // a timer due at once would be run in the same pass
+
+namespace evt_loop {
+
+TcpRelay::TcpRelay(TcpConnection* conn_a, TcpConnection* conn_b, const OnRelayClosedCallback& closed_cb) :
+    running_(false), closing_(false),
+    close_timer_(std::bind(&TcpRelay::OnCloseTimer, this, std::placeholders::_1)), closed_cb_(closed_cb)
+{
+    memset(channels_, 0, sizeof(channels_));
+    channels_[0].src = conn_a;
+    channels_[0].dst = conn_b;
+    channels_[1].src = conn_b;
+    channels_[1].dst = conn_a;
+    for (int i = 0; i < 2; i++) {
+        channels_[i].pipe_fds[0] = channels_[i].pipe_fds[1] = -1;
+    }
+}
+
+TcpRelay::~TcpRelay()
+{
+    Stop();
+}
+
+bool TcpRelay::Start()
+{
+    if (running_) return true;
+
+    TcpConnection* conn_a = channels_[0].src;
+    TcpConnection* conn_b = channels_[0].dst;
+    if (conn_a == NULL || conn_b == NULL || conn_a == conn_b || conn_a->Relay() || conn_b->Relay()) {
+        return false;
+    }
+    /// Messages queued before the relay starts would interleave with spliced bytes
+    if (!conn_a->TxBuffEmpty() || !conn_b->TxBuffEmpty()) {
+        EL_LOG_WARN("[TcpRelay::Start] output buffer is not empty, fd: %d, %d", conn_a->FD(), conn_b->FD());
+        return false;
+    }
+    if (!OpenChannel(channels_[0]) || !OpenChannel(channels_[1])) {
+        CloseChannel(channels_[0]);
+        CloseChannel(channels_[1]);
+        return false;
+    }
+
+    running_ = true;
+    conn_a->SetRelay(this);
+    conn_b->SetRelay(this);
+
+    for (int i = 0; i < 2; i++) {
+        Channel& ch = channels_[i];
+        /// Bytes of a partially received message are forwarded ahead of the spliced stream
+        string pending;
+        if (ch.src->TakeRxBuffer(pending) > 0) {
+            ssize_t n = write(ch.pipe_fds[1], pending.data(), pending.size());
+            if (n != (ssize_t)pending.size()) {
+                EL_LOG_ERROR("[TcpRelay::Start] failed to forward pending data, fd: %d", ch.src->FD());
+                Stop();
+                return false;
+            }
+            ch.buffered = n;
+            ch.dst->AddWriteEvent();
+        }
+        ch.src->AddReadEvent();
+    }
+    EL_LOG_INFO("[TcpRelay::Start] relay started, fd: %d <-> %d", conn_a->FD(), conn_b->FD());
+    return true;
+}
+
+void TcpRelay::Stop()
+{
+    if (!running_) return;
+    running_ = false;
+    bool closing = closing_;
+    closing_ = false;
+    if (close_timer_.IsRunning()) close_timer_.Stop();
+
+    for (int i = 0; i < 2; i++) {
+        Channel& ch = channels_[i];
+        if (ch.buffered == 0 || ch.dst == NULL) {
+            continue;
+        }
+        MessagePtr rest = CreateMessage(MessageType::CRLF);  // raw bytes, sent as they are
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(ch.pipe_fds[0], buffer, sizeof(buffer))) > 0) {
+            rest->AppendRawData(buffer, n);
+        }
+        ch.dst->SendShared(rest);
+    }
+    for (int i = 0; i < 2; i++) {
+        TcpConnection* conn = channels_[i].src;
+        if (conn == NULL) {
+            CloseChannel(channels_[i]);
+            continue;
+        }
+        if (closing) EV_Singleton->AddEvent(conn);
+        conn->SetRelay(NULL);
+        conn->AddReadEvent();
+        if (conn->TxBuffEmpty()) {
+            conn->DeleteWriteEvent();
+        }
+        CloseChannel(channels_[i]);
+    }
+}
+
+void TcpRelay::OnEvents(TcpConnection* conn, uint32_t events)
+{
+    if (!running_ || closing_) return;
+
+    if (events & IOEvent::ERROR) {
+        Close();
+        return;
+    }
+    for (int i = 0; i < 2; i++) {
+        Channel& ch = channels_[i];
+        if ((events & IOEvent::WRITE) && ch.dst == conn) {
+            if (Drain(ch) < 0) {
+                Close();
+                return;
+            }
+            if (ch.buffered == 0) {
+                /// The pipe is drained, resume reading on the source side
+                conn->DeleteWriteEvent();
+                if (!ch.eof) ch.src->AddReadEvent();
+            }
+        }
+        if ((events & IOEvent::READ) && ch.src == conn) {
+            if (Pump(ch) < 0) {
+                Close();
+                return;
+            }
+        }
+    }
+    if (channels_[0].shutdown && channels_[1].shutdown) {
+        Close();
+    }
+}
+
+void TcpRelay::OnConnectionDestroyed(TcpConnection* conn)
+{
+    if (!running_) return;
+    if (closing_) {
+        /// Only the other one is left to tear down
+        for (int i = 0; i < 2; i++) {
+            if (channels_[i].src == conn) channels_[i].src = NULL;
+            if (channels_[i].dst == conn) channels_[i].dst = NULL;
+        }
+        return;
+    }
+    Stop();
+    if (closed_cb_) closed_cb_(this);
+}
+
+bool TcpRelay::OpenChannel(Channel& ch)
+{
+    if (pipe2(ch.pipe_fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+        EL_LOG_ERROR("[TcpRelay::OpenChannel] pipe2 error: %s", strerror(errno));
+        ch.pipe_fds[0] = ch.pipe_fds[1] = -1;
+        return false;
+    }
+    fcntl(ch.pipe_fds[1], F_SETPIPE_SZ, RELAY_PIPE_SIZE);
+    int capacity = fcntl(ch.pipe_fds[1], F_GETPIPE_SZ);
+    ch.capacity = capacity > 0 ? capacity : RELAY_PIPE_SIZE;
+    ch.buffered = 0;
+    ch.eof = false;
+    ch.shutdown = false;
+    return true;
+}
+
+void TcpRelay::CloseChannel(Channel& ch)
+{
+    for (int i = 0; i < 2; i++) {
+        if (ch.pipe_fds[i] >= 0) {
+            close(ch.pipe_fds[i]);
+            ch.pipe_fds[i] = -1;
+        }
+    }
+    ch.buffered = 0;
+}
+
+/// Moves bytes from the source socket into the pipe, then on to the destination
+int TcpRelay::Pump(Channel& ch)
+{
+    if (ch.buffered < ch.capacity) {
+        ssize_t n = splice(ch.src->FD(), NULL, ch.pipe_fds[1], NULL, ch.capacity - ch.buffered, RELAY_SPLICE_FLAGS);
+        if (n > 0) {
+            ch.buffered += n;
+        } else if (n == 0) {
+            ch.eof = true;
+            ch.src->DeleteReadEvent();
+        } else if (errno != EAGAIN && errno != EINTR) {
+            EL_LOG_ERROR("[TcpRelay::Pump] splice error, fd: %d, error string: %s", ch.src->FD(), strerror(errno));
+            return -1;
+        }
+    }
+    if (Drain(ch) < 0) {
+        return -1;
+    }
+    if (ch.buffered > 0) {
+        /// The destination is slower than the source, hold the source until the pipe drains
+        ch.src->DeleteReadEvent();
+        ch.dst->AddWriteEvent();
+    }
+    return 0;
+}
+
+/// Moves bytes from the pipe to the destination socket
+int TcpRelay::Drain(Channel& ch)
+{
+    while (ch.buffered > 0) {
+        ssize_t n = splice(ch.pipe_fds[0], NULL, ch.dst->FD(), NULL, ch.buffered, RELAY_SPLICE_FLAGS);
+        if (n > 0) {
+            ch.buffered -= n;
+            ch.forwarded += n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            break;
+        } else {
+            EL_LOG_ERROR("[TcpRelay::Drain] splice error, fd: %d, error string: %s", ch.dst->FD(), strerror(errno));
+            return -1;
+        }
+    }
+    if (ch.buffered == 0 && ch.eof && !ch.shutdown) {
+        shutdown(ch.dst->FD(), SHUT_WR);
+        ch.shutdown = true;
+    }
+    return 0;
+}
+
+/// Ends the relay. The connections leave the loop until the teardown, so
+/// neither has an event of the same pass left when it is destroyed.
+void TcpRelay::Close()
+{
+    if (closing_) return;
+    EL_LOG_INFO("[TcpRelay::Close] relay closed, forwarded: %lu / %lu bytes",
+        channels_[0].forwarded, channels_[1].forwarded);
+    closing_ = true;
+    EV_Singleton->DeleteEvent(channels_[0].src);
+    EV_Singleton->DeleteEvent(channels_[1].src);
+    close_timer_.SetInterval(TimeVal(0, RELAY_CLOSE_DELAY_US));
+    close_timer_.Start();
+}
+
+/// The closed callback owns the connections from here on, without one both
+/// connections are disconnected
+void TcpRelay::OnCloseTimer(PeriodicTimer* timer)
+{
+    timer->Stop();
+    TcpConnection* conn_a = channels_[0].src;
+    TcpConnection* conn_b = channels_[0].dst;
+    Stop();
+    if (closed_cb_) {
+        closed_cb_(this);
+        return;
+    }
+    if (conn_a) conn_a->Disconnect();
+    if (conn_b) conn_b->Disconnect();
+}
+
+}  // namespace evt_loop
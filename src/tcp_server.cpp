@@ -1,12 +1,23 @@
 #include "eventloop.h"
 #include "tcp_server.h"
+#include "logger.h"
 #include <unistd.h>
+#include <fcntl.h>
+
+#define DEFAULT_ACCEPT_BATCH    256
+#define ACCEPT_RETRY_MS         100     // pause of accepting after running out of fds
 
 namespace evt_loop {
 
 TcpServer::TcpServer(const char *host, uint16_t port, MessageType msg_type, TcpCallbacksPtr tcp_evt_cbs)
-    : msg_type_(msg_type), tcp_evt_cbs_(tcp_evt_cbs)
+    : IOEvent(-1, IOEvent::READ | IOEvent::ERROR | IOEvent::NONBLOCK),
+      msg_type_(msg_type), backlog_(SOMAXCONN), accept_batch_(DEFAULT_ACCEPT_BATCH),
+      max_conns_(0), accept_paused_(false),
+      accept_timer_(std::bind(&TcpServer::OnAcceptTimer, this, std::placeholders::_1)),
+      reserve_fd_(-1), rejected_(0), tcp_evt_cbs_(tcp_evt_cbs)
 {
+    accept_timer_.SetInterval(TimeVal(0, ACCEPT_RETRY_MS * 1000));
+    reserve_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
     server_addr_.port_ = port;
     if (host[0] == '\0' || strcmp(host, "localhost") == 0) {
         server_addr_.ip_ = "127.0.0.1";
@@ -19,6 +30,28 @@ TcpServer::TcpServer(const char *host, uint16_t port, MessageType msg_type, TcpC
     Start();
 }
 
+TcpServer::TcpServer(int listen_fd, MessageType msg_type, TcpCallbacksPtr tcp_evt_cbs)
+    : IOEvent(-1, IOEvent::READ | IOEvent::ERROR),
+      msg_type_(msg_type), backlog_(SOMAXCONN), accept_batch_(DEFAULT_ACCEPT_BATCH),
+      max_conns_(0), accept_paused_(false),
+      accept_timer_(std::bind(&TcpServer::OnAcceptTimer, this, std::placeholders::_1)),
+      reserve_fd_(-1), rejected_(0), tcp_evt_cbs_(tcp_evt_cbs)
+{
+    accept_timer_.SetInterval(TimeVal(0, ACCEPT_RETRY_MS * 1000));
+    reserve_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    struct sockaddr_storage sock_addr;
+    socklen_t addr_len = sizeof(sock_addr);
+    if (getsockname(listen_fd, (sockaddr*)&sock_addr, &addr_len) == -1) {
+        OnError(errno, strerror(errno));
+        return;
+    }
+    SocketAddrToIPAddress((sockaddr*)&sock_addr, addr_len, server_addr_);
+    listen_addr_ = SockAddr((sockaddr*)&sock_addr, addr_len);
+    fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+    SetFD(listen_fd);   // made non-blocking as it is added to the loop
+}
+
 TcpServer::~TcpServer()
 {
     Destory();
@@ -26,7 +59,14 @@ TcpServer::~TcpServer()
 
 void TcpServer::Destory()
 {
-    conn_map_.clear();
+    if (accept_timer_.IsRunning()) accept_timer_.Stop();
+    if (reserve_fd_ >= 0) close(reserve_fd_);
+    reserve_fd_ = -1;
+    conn_table_.Clear();
+    if (fd_ >= 0 && listen_addr_.Family() == AF_UNIX && server_addr_.ip_.size() > strlen(UNIX_ADDR_PREFIX)
+        && server_addr_.ip_[strlen(UNIX_ADDR_PREFIX)] != '@') {
+        unlink(server_addr_.ip_.c_str() + strlen(UNIX_ADDR_PREFIX));
+    }
     close(fd_);
     SetFD(-1);
 }
@@ -35,49 +75,149 @@ void TcpServer::SetTcpCallbacks(const TcpCallbacksPtr& tcp_evt_cbs)
 {
     tcp_evt_cbs_ = tcp_evt_cbs;
 
-    FdTcpConnMap::iterator iter;
-    for (iter = conn_map_.begin(); iter != conn_map_.end(); ++iter) {
-        iter->second->SetTcpCallbacks(tcp_evt_cbs_);
-    }
+    conn_table_.ForEach([&](TcpConnection* conn) { conn->SetTcpCallbacks(tcp_evt_cbs_); });
 }
 
-TcpConnectionPtr TcpServer::GetConnectionByFD(int fd)
+void TcpServer::SetSocketOptions(const SocketOptions& opts)
 {
-    FdTcpConnMap::iterator iter = conn_map_.find(fd);
-    return (iter != conn_map_.end() ? iter->second : nullptr);
+    sock_opts_ = opts;
+    if (fd_ >= 0) sock_opts_.ApplyListener(fd_);
 }
 
-bool TcpServer::Start()
+void TcpServer::SetBacklog(int backlog)
 {
-    int fd = -1;
-    if ((fd = socket(PF_INET, SOCK_STREAM, 0)) == -1) {
+    backlog_ = backlog;
+    /// listen() again on a listening socket only updates the backlog
+    if (fd_ >= 0 && listen(fd_, backlog_) == -1) {
         OnError(errno, strerror(errno));
-        return false;
     }
-    int reuseaddr = 1;
-    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr)) == -1)
-    {
+}
+
+void TcpServer::SetMaxConnections(size_t max_conns)
+{
+    max_conns_ = max_conns;
+    if (AtCapacity()) {
+        PauseAccept();
+    } else if (!accept_timer_.IsRunning()) {
+        ResumeAccept();
+    }
+}
+
+void TcpServer::StopAccepting()
+{
+    if (fd_ < 0) {
+        return;
+    }
+    if (accept_timer_.IsRunning()) accept_timer_.Stop();
+    accept_paused_ = false;
+    int fd = fd_;
+    SetFD(-1);
+    close(fd);
+    EL_LOG_INFO("[TcpServer::StopAccepting] listening socket closed, fd: %d, connections: %lu", fd, conn_table_.Size());
+}
+
+int TcpServer::DetachConnection(int fd, string& pending, size_t max_pending)
+{
+    TcpConnectionPtr conn = conn_table_.Find(fd);
+    if (!conn || conn->Detach(pending, max_pending) < 0) {
+        return -1;
+    }
+    conn_table_.Erase(fd);
+    return fd;
+}
+
+TcpConnectionPtr TcpServer::AdoptConnection(int fd, const string& pending)
+{
+    struct sockaddr_storage peer_addr;
+    socklen_t addr_len = sizeof(peer_addr);
+    if (getpeername(fd, (sockaddr*)&peer_addr, &addr_len) == -1) {
         OnError(errno, strerror(errno));
-        close(fd);
-        return false;
+        return nullptr;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    sock_opts_.ApplyConnection(fd);     // tuned by another process
+    TcpConnectionPtr conn = OnNewClient(fd, SockAddr((sockaddr*)&peer_addr, addr_len));
+    if (!conn->FeedRxBuffer(pending.data(), pending.size())) {
+        return nullptr;     // closed by the pending bytes, e.g. an oversized frame
+    }
+    return conn;
+}
+
+TcpConnectionPtr TcpServer::GetConnectionByFD(int fd)
+{
+    return conn_table_.Find(fd);
+}
+
+size_t TcpServer::Broadcast(const Message& msg)
+{
+    return Broadcast(CreateMessage(msg));
+}
+
+size_t TcpServer::Broadcast(const char* data, uint32_t len)
+{
+    if (framing_.Valid()) return Broadcast(CreateMessage(framing_, data, len));
+    return Broadcast(CreateMessage(msg_type_, data, len));
+}
+
+size_t TcpServer::Broadcast(const MessagePtr& msg)
+{
+    if (!msg) return 0;
+    conn_table_.ForEach([&](TcpConnection* conn) { conn->SendShared(msg); });
+    return conn_table_.Size();
+}
+
+/// A socket file left behind by a server that is gone refuses connections,
+/// it is removed so that bind() does not fail. One still served is kept.
+static void RemoveStaleUnixSocket(const struct sockaddr_storage& sock_addr, socklen_t len)
+{
+    const struct sockaddr_un* un = (const struct sockaddr_un*)&sock_addr;
+    if (un->sun_path[0] == '\0') {
+        return;     // abstract names go away with their socket
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return;
     }
+    if (connect(fd, (const struct sockaddr*)&sock_addr, len) == -1 && errno == ECONNREFUSED) {
+        unlink(un->sun_path);
+    }
+    close(fd);
+}
 
-    int on = 1;
-    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int));
+bool TcpServer::Start()
+{
+    struct sockaddr_storage sock_addr;
+    socklen_t addr_len = 0;
+    if (!IPAddressToSocketAddr(server_addr_, sock_addr, addr_len)) {
+        OnError(EINVAL, "invalid listening address");
+        return false;
+    }
 
-    sockaddr_in sock_addr;
-    memset(&sock_addr, 0, sizeof(sockaddr_in));
-    sock_addr.sin_family = PF_INET;
-    sock_addr.sin_port = htons(server_addr_.port_);
-    if (inet_aton(server_addr_.ip_.c_str(), &sock_addr.sin_addr) == 0) {
+    int fd = -1;
+    if ((fd = socket(sock_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
         OnError(errno, strerror(errno));
         return false;
     }
+    if (sock_addr.ss_family == AF_UNIX) {
+        RemoveStaleUnixSocket(sock_addr, addr_len);
+    } else {
+        int reuseaddr = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr)) == -1)
+        {
+            OnError(errno, strerror(errno));
+            close(fd);
+            return false;
+        }
+    }
+    sock_opts_.ApplyListener(fd);
 
-    if (bind(fd, (sockaddr*)&sock_addr, sizeof(sockaddr_in)) == -1 || listen(fd, 10) == -1) {
+    if (bind(fd, (sockaddr*)&sock_addr, addr_len) == -1 || listen(fd, backlog_) == -1) {
         OnError(errno, strerror(errno));
+        close(fd);
         return false;
     }
+    listen_addr_ = SockAddr((sockaddr*)&sock_addr, addr_len);
     SetFD(fd);
 
     return true;
@@ -86,17 +226,27 @@ bool TcpServer::Start()
 void TcpServer::OnEvents(uint32_t events)
 {
     if (events & IOEvent::READ) {
-        struct sockaddr_in sock_addr;
-        uint32_t size = sizeof(sock_addr);
-
-        int fd = accept(fd_, (struct sockaddr*)&sock_addr, &size);
-        if (fd < 0) {
-            OnError(errno, strerror(errno));
-            return;
+        /// Takes pending connections until the backlog is empty or the batch is
+        /// full, the sockets come non-blocking and close-on-exec in one call
+        for (uint32_t i = 0; i < accept_batch_; i++) {
+            if (AtCapacity()) {
+                PauseAccept();
+                break;
+            }
+            struct sockaddr_storage sock_addr;
+            socklen_t size = sizeof(sock_addr);
+            int fd = accept4(fd_, (struct sockaddr*)&sock_addr, &size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    OnAcceptError(errno);
+                }
+                break;
+            }
+            OnNewClient(fd, SockAddr((struct sockaddr*)&sock_addr, size));
         }
-        IPAddress peer_addr;
-        SocketAddrToIPAddress(sock_addr, peer_addr);
-        OnNewClient(fd, peer_addr);
     }
 
     if (events & IOEvent::ERROR) {
@@ -104,29 +254,85 @@ void TcpServer::OnEvents(uint32_t events)
     }
 }
 
-void TcpServer::OnNewClient(int fd, const IPAddress& peer_addr)
+/// Connection objects and their reference counts come from the thread's pool,
+/// so a churn of clients does not go through malloc
+TcpConnectionPtr TcpServer::OnNewClient(int fd, const SockAddr& peer_addr)
 {
-    TcpConnectionPtr conn = std::make_shared<TcpConnection>(fd, server_addr_, peer_addr,
-          std::bind(&TcpServer::OnConnectionClosed, this, std::placeholders::_1), tcp_evt_cbs_);
-    conn->SetMessageType(msg_type_);
-    conn_map_.insert(std::make_pair(fd, conn));
+    TcpConnectionPtr conn = std::allocate_shared<TcpConnection>(PoolAllocator<TcpConnection>(), fd, listen_addr_, peer_addr,
+          std::bind(&TcpServer::OnConnectionClosed, this, std::placeholders::_1), tcp_evt_cbs_,
+          IOEvent::READ | IOEvent::ERROR | IOEvent::NONBLOCK);
+    if (framing_.Valid()) {
+        conn->SetFraming(framing_);
+    } else {
+        conn->SetMessageType(msg_type_);
+    }
+    if (sock_opts_.tcp_quickack > 0) conn->SetQuickAck(true);
+    conn_table_.Insert(fd, conn);
     if (tcp_evt_cbs_) tcp_evt_cbs_->on_new_client_cb(conn.get());
-    printf("[TcpServer::OnNewClient] new connection, fd: %d\n", fd);
+    EL_LOG_INFO("[TcpServer::OnNewClient] new connection, fd: %d", fd);
+    return conn;
 }
 
 void TcpServer::OnConnectionClosed(TcpConnection* conn)
 {
-    printf("[TcpServer::OnConnectionClosed] Erase connection, fd: %d\n", conn->FD());
-    FdTcpConnMap::iterator iter = conn_map_.find(conn->FD());
-    if (iter != conn_map_.end()) {
-        //delete iter->second;
-        conn_map_.erase(iter);
+    EL_LOG_INFO("[TcpServer::OnConnectionClosed] Erase connection, fd: %d", conn->FD());
+    conn_table_.Erase(conn->FD());
+    if (accept_paused_ && !AtCapacity() && !accept_timer_.IsRunning()) {
+        ResumeAccept();
+    }
+}
+
+/// The listening socket stays readable while accept() fails, so accepting is
+/// paused for a while instead of spinning on it. Out of fds, the pending
+/// clients that can not be served are taken with the reserve fd and closed,
+/// so they fail fast instead of waiting in the backlog.
+void TcpServer::OnAcceptError(int errcode)
+{
+    if (errcode == EMFILE || errcode == ENFILE) {
+        for (uint32_t i = 0; i < accept_batch_ && reserve_fd_ >= 0; i++) {
+            close(reserve_fd_);
+            int fd = accept(fd_, NULL, NULL);
+            if (fd >= 0) {
+                close(fd);
+                rejected_++;
+            }
+            reserve_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if (fd < 0) break;
+        }
+        EL_LOG_WARN("[TcpServer::OnAcceptError] out of fds, accepting paused, connections: %lu, rejected: %lu",
+            conn_table_.Size(), rejected_);
+    } else if (errcode != ENOBUFS && errcode != ENOMEM) {
+        OnError(errcode, strerror(errcode));
+        return;
     }
+    PauseAccept();
+    if (!accept_timer_.IsRunning()) accept_timer_.Start();
+    if (tcp_evt_cbs_) tcp_evt_cbs_->on_error_cb(errcode, strerror(errcode));
+}
+
+void TcpServer::OnAcceptTimer(PeriodicTimer* timer)
+{
+    timer->Stop();
+    if (!AtCapacity()) ResumeAccept();
+}
+
+void TcpServer::PauseAccept()
+{
+    if (accept_paused_) return;
+    accept_paused_ = true;
+    DeleteReadEvent();
+}
+
+void TcpServer::ResumeAccept()
+{
+    if (!accept_paused_) return;
+    accept_paused_ = false;
+    AddReadEvent();
 }
 
 void TcpServer::OnError(int errcode, const char* errstr)
 {
-    printf("[TcpServer::OnError] error code: %d, error string: %s\n", errcode, errstr);
+    EL_LOG_ERROR("[TcpServer::OnError] error code: %d, error string: %s", errcode, errstr);
     if (tcp_evt_cbs_) tcp_evt_cbs_->on_error_cb(errcode, errstr);
 }
 
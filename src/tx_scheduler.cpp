@@ -0,0 +1,161 @@
+#include "tx_scheduler.h"
+#include <algorithm>
+
+#define TX_WIRE_BUDGET      (64 * 1024)   // bytes kept on the wire queue
+#define TX_QUANTUM          (16 * 1024)   // bytes per round and unit of weight
+
+namespace evt_loop {
+
+TxScheduler::TxScheduler() :
+  wire_bytes_(0), lane_bytes_(0), queued_msgs_(0), cur_lane_(0), frag_size_(0), frag_lane_(-1)
+{
+  static const uint32_t DEFAULT_WEIGHTS[TX_LANE_COUNT] = { 8, 4, 2, 1 };
+  for (int i = 0; i < TX_LANE_COUNT; i++) {
+    lanes_[i].weight = DEFAULT_WEIGHTS[i];
+  }
+}
+
+void TxScheduler::Push(const MessagePtr& msg, TxLane lane, bool report) {
+  Frame frame;
+  frame.data = msg;
+  if (report) frame.done = msg;
+  lanes_[lane].mq.push(frame);
+  lane_bytes_ += msg->Size();
+  queued_msgs_++;
+}
+
+void TxScheduler::PushWire(const MessagePtr& msg, bool report) {
+  Frame frame;
+  frame.data = msg;
+  if (report) frame.done = msg;
+  wire_.push(frame);
+  wire_bytes_ += msg->Size();
+}
+
+void TxScheduler::PopWire() {
+  wire_bytes_ -= wire_.front().data->Size();
+  wire_.pop();
+}
+
+void TxScheduler::Clear() {
+  for (int i = 0; i < TX_LANE_COUNT; i++) {
+    lanes_[i].mq.clear();
+    lanes_[i].deficit = 0;
+    lanes_[i].credited = false;
+    lanes_[i].frag_offset = 0;
+  }
+  wire_.clear();
+  wire_bytes_ = 0;
+  lane_bytes_ = 0;
+  queued_msgs_ = 0;
+  frag_lane_ = -1;
+}
+
+/// Deficit round robin: a lane is credited weight * TX_QUANTUM bytes when
+/// its turn comes and sends head messages while they fit into its deficit
+void TxScheduler::Schedule() {
+  while (wire_bytes_ < TX_WIRE_BUDGET && queued_msgs_ > 0) {
+    Lane& lane = lanes_[cur_lane_];
+    if (lane.mq.empty()) {
+      lane.deficit = 0;
+      Advance();
+      continue;
+    }
+    /// Another lane is in the middle of a fragmented message
+    if (frag_lane_ >= 0 && frag_lane_ != cur_lane_ && NeedsFragment(lane.mq.front().data)) {
+      Advance();
+      continue;
+    }
+    if (!lane.credited) {
+      lane.deficit += lane.weight * TX_QUANTUM;
+      lane.credited = true;
+    }
+    size_t frame_size = NextFrameSize(lane);
+    if (frame_size > lane.deficit) {
+      Advance();
+      continue;
+    }
+    lane.deficit -= frame_size;
+    EmitNext(cur_lane_);
+    if (lane.mq.empty()) {
+      lane.deficit = 0;
+      Advance();
+    }
+  }
+}
+
+void TxScheduler::Advance() {
+  lanes_[cur_lane_].credited = false;
+  cur_lane_ = (cur_lane_ + 1) % TX_LANE_COUNT;
+}
+
+bool TxScheduler::NeedsFragment(const MessagePtr& msg) const {
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+  return frag_size_ > 0 && msg->Type() == MessageType::BINARY && msg->Size() > sizeof(BinaryMessage::HDR) + frag_size_;
+#else
+  return false;
+#endif
+}
+
+size_t TxScheduler::NextFrameSize(const Lane& lane) const {
+  const MessagePtr& head = lane.mq.front().data;
+  if (!NeedsFragment(head)) {
+    return head->Size();
+  }
+  return sizeof(BinaryMessage::HDR) + std::min(frag_size_, head->PayloadSize() - lane.frag_offset);
+}
+
+void TxScheduler::EmitNext(int index) {
+  Lane& lane = lanes_[index];
+  MessagePtr head = lane.mq.front().data;
+  Frame frame;
+  frame.done = lane.mq.front().done;
+  bool finished = true;
+#ifdef _BINARY_MSG_EXTEND_PACKAGING
+  if (NeedsFragment(head)) {
+    const BinaryMessage* bmsg = static_cast<const BinaryMessage*>(head.get());
+    size_t size = std::min(frag_size_, bmsg->PayloadSize() - lane.frag_offset);
+    const char* payload = bmsg->Payload() + lane.frag_offset;
+    bool last = (lane.frag_offset + size == bmsg->PayloadSize());
+
+    BinaryMessage::HDR hdr = *bmsg->Header();
+    hdr.length = sizeof(hdr) + size;
+    hdr.flags |= BinaryMessage::FLAG_FRAGMENT;
+    if (!last) hdr.flags |= BinaryMessage::FLAG_MORE_FRAGMENTS;
+    if (hdr.flags & BinaryMessage::FLAG_CHECKSUM) {
+      hdr.checksum = Crc32c(payload, size);   // every fragment is verified on its own
+    }
+    frame.data = CreateMessage(MessageType::BINARY);
+    frame.data->Reserve(hdr.length);
+    frame.data->AppendRawData((const char*)&hdr, sizeof(hdr));
+    frame.data->AppendRawData(payload, size);
+    static_cast<BinaryMessage*>(frame.data.get())->ResetHeader();
+
+    lane_bytes_ -= size;
+    if (last) {
+      lane_bytes_ -= sizeof(hdr);   // the header of the original message goes last
+      lane.frag_offset = 0;
+      frag_lane_ = -1;
+    } else {
+      lane.frag_offset += size;
+      frag_lane_ = index;
+      frame.done.reset();
+      finished = false;
+    }
+  } else {
+    frame.data = head;
+    lane_bytes_ -= head->Size();
+  }
+#else
+  frame.data = head;
+  lane_bytes_ -= head->Size();
+#endif
+  if (finished) {
+    lane.mq.pop();
+    queued_msgs_--;
+  }
+  wire_bytes_ += frame.data->Size();
+  wire_.push(frame);
+}
+
+}  // namespace evt_loop
@@ -0,0 +1,351 @@
+#include "eventloop.h"
+#include "udp_socket.h"
+#include "logger.h"
+#include <unistd.h>
+#include <netinet/udp.h>
+#include <algorithm>
+
+#define DEFAULT_UDP_BATCH       64
+#define DEFAULT_DATAGRAM_SIZE   2048
+#define DEFAULT_MAX_PENDING     65536
+#define GRO_BUFFER_SIZE         65536   // a coalesced receive is at most this long
+#define UDP_MAX_PAYLOAD         65507
+#define UDP_MAX_SEGMENTS        64      // datagrams per GSO buffer, as the kernel allows
+#define RX_MAX_ROUNDS           8       // recvmmsg() calls per readiness event at most
+#define CONTROL_WORDS           (CMSG_SPACE(sizeof(int)) / sizeof(uint64_t))
+
+namespace evt_loop {
+
+static bool SamePeer(const SockAddr& a, const SockAddr& b)
+{
+    return a.Family() == b.Family() && memcmp(&a.sa, &b.sa, a.Length()) == 0;
+}
+
+UdpSocket::UdpSocket(const char* host, uint16_t port, Role role, UdpCallbacksPtr udp_evt_cbs)
+    : IOEvent(-1, IOEvent::READ | IOEvent::ERROR | IOEvent::NONBLOCK),
+      batch_size_(DEFAULT_UDP_BATCH), max_datagram_size_(DEFAULT_DATAGRAM_SIZE), gro_(false), gso_size_(0),
+      max_pending_(DEFAULT_MAX_PENDING), tx_head_(0), rx_count_(0), tx_count_(0), tx_dropped_(0),
+      udp_evt_cbs_(udp_evt_cbs)
+{
+    IPAddress addr;
+    addr.port_ = port;
+    if (host[0] == '\0' || strcmp(host, "localhost") == 0) {
+        addr.ip_ = "127.0.0.1";
+    } else if (strcmp(host, "any") == 0) {
+        addr.ip_ = "0.0.0.0";
+    } else {
+        addr.ip_ = host;
+    }
+    PrepareRx();
+    Open(addr, role);
+}
+
+UdpSocket::~UdpSocket()
+{
+    Flush();
+    Close();
+}
+
+void UdpSocket::SetBatch(uint32_t batch_size, uint32_t max_datagram_size)
+{
+    batch_size_ = batch_size > 0 ? batch_size : 1;
+    max_datagram_size_ = std::min<uint32_t>(std::max<uint32_t>(max_datagram_size, 1), GRO_BUFFER_SIZE);
+    PrepareRx();
+}
+
+bool UdpSocket::EnableGro(bool enable)
+{
+    int on = enable ? 1 : 0;
+    if (fd_ < 0 || setsockopt(fd_, SOL_UDP, UDP_GRO, &on, sizeof(on)) == -1) {
+        return false;
+    }
+    gro_ = enable;
+    PrepareRx();
+    return true;
+}
+
+bool UdpSocket::SendTo(const char* data, uint32_t len, const SockAddr& peer)
+{
+    if (fd_ < 0 || len > UDP_MAX_PAYLOAD || PendingCount() >= max_pending_) {
+        tx_dropped_++;
+        return false;
+    }
+    if (PendingCount() == 0) {
+        AddWriteEvent();    // flushed in the next loop iteration at the latest
+    }
+    TxEntry entry;
+    entry.offset = tx_buffer_.size();
+    entry.size = len;
+    entry.peer = peer;
+    tx_buffer_.append(data, len);
+    tx_queue_.push_back(entry);
+
+    if (PendingCount() >= batch_size_) {
+        Flush();
+    }
+    return true;
+}
+
+size_t UdpSocket::Flush()
+{
+    size_t sent = 0;
+    while (fd_ >= 0 && tx_head_ < tx_queue_.size()) {
+        size_t max_iovs = gso_size_ > 0 ? UDP_MAX_SEGMENTS : 1;
+        tx_msgs_.resize(batch_size_);
+        tx_iovs_.resize(batch_size_ * max_iovs);
+        tx_control_.resize(batch_size_ * CONTROL_WORDS);
+        tx_counts_.resize(batch_size_);
+
+        size_t next = tx_head_;
+        uint32_t count = 0;
+        while (count < batch_size_ && next < tx_queue_.size()) {
+            tx_counts_[count] = PackTx(next, tx_msgs_[count], &tx_iovs_[count * max_iovs],
+                (char*)&tx_control_[count * CONTROL_WORDS]);
+            next += tx_counts_[count];
+            count++;
+        }
+
+        int n = sendmmsg(fd_, &tx_msgs_[0], count, MSG_DONTWAIT);
+        if (n < 0) {
+            int err = errno;
+            if (err == EINTR) {
+                continue;
+            }
+            if (err == EAGAIN || err == EWOULDBLOCK) {
+                break;      // the send buffer is full, the WRITE event stays on
+            }
+            if (gso_size_ > 0 && tx_counts_[0] > 1 && (err == EIO || err == EINVAL)) {
+                gso_size_ = 0;
+                OnError(err, "UDP segmentation offload is not supported, disabled");
+                continue;
+            }
+            /// The first datagram was refused (e.g. ECONNREFUSED after an ICMP
+            /// error, EMSGSIZE), it is dropped so that the others can go
+            tx_dropped_ += tx_counts_[0];
+            tx_head_ += tx_counts_[0];
+            OnError(err, strerror(err));
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            tx_head_ += tx_counts_[i];
+            sent += tx_counts_[i];
+        }
+    }
+    tx_count_ += sent;
+
+    if (tx_head_ == tx_queue_.size()) {
+        tx_queue_.clear();
+        tx_buffer_.clear();
+        tx_head_ = 0;
+        DeleteWriteEvent();
+    } else if (tx_head_ >= batch_size_) {
+        /// Backed up, the sent part goes so that the queue does not only grow
+        uint32_t base = tx_queue_[tx_head_].offset;
+        tx_buffer_.erase(0, base);
+        tx_queue_.erase(tx_queue_.begin(), tx_queue_.begin() + tx_head_);
+        for (size_t i = 0; i < tx_queue_.size(); i++) {
+            tx_queue_[i].offset -= base;
+        }
+        tx_head_ = 0;
+    }
+    return sent;
+}
+
+void UdpSocket::OnError(int errcode, const char* errstr)
+{
+    EL_LOG_ERROR("[UdpSocket::OnError] error code: %d, error string: %s", errcode, errstr);
+    if (udp_evt_cbs_ && udp_evt_cbs_->on_error_cb) udp_evt_cbs_->on_error_cb(errcode, errstr);
+}
+
+bool UdpSocket::Open(const IPAddress& addr, Role role)
+{
+    struct sockaddr_storage sock_addr;
+    socklen_t addr_len = 0;
+    if (!IPAddressToSocketAddr(addr, sock_addr, addr_len) || sock_addr.ss_family == AF_UNIX) {
+        OnError(EINVAL, "invalid UDP address");
+        return false;
+    }
+
+    int fd = socket(sock_addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        OnError(errno, strerror(errno));
+        return false;
+    }
+    int ret = (role == SERVER) ? bind(fd, (sockaddr*)&sock_addr, addr_len) : connect(fd, (sockaddr*)&sock_addr, addr_len);
+    if (ret == -1) {
+        OnError(errno, strerror(errno));
+        close(fd);
+        return false;
+    }
+    struct sockaddr_storage local_addr;
+    socklen_t local_len = sizeof(local_addr);
+    getsockname(fd, (sockaddr*)&local_addr, &local_len);
+    local_addr_ = SockAddr((sockaddr*)&local_addr, local_len);
+    SetFD(fd);
+
+    return true;
+}
+
+void UdpSocket::Close()
+{
+    if (fd_ >= 0) {
+        int fd = fd_;
+        SetFD(-1);
+        close(fd);
+    }
+}
+
+void UdpSocket::OnEvents(uint32_t events)
+{
+    if (events & IOEvent::WRITE) {
+        Flush();
+    }
+    if (events & IOEvent::READ) {
+        Receive();
+    }
+    if (events & IOEvent::ERROR) {
+        /// Reading the pending error clears it, e.g. an ICMP error of a CLIENT
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (fd_ >= 0 && getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err != 0) {
+            OnError(err, strerror(err));
+        }
+    }
+}
+
+/// Takes a few batches per readiness event, what is left is taken in the
+/// next loop iteration so that other events are not starved. Replies queued
+/// by the callback go out right after it.
+void UdpSocket::Receive()
+{
+    for (int round = 0; round < RX_MAX_ROUNDS && fd_ >= 0; round++) {
+        for (uint32_t i = 0; i < batch_size_; i++) {
+            struct msghdr& hdr = rx_msgs_[i].msg_hdr;
+            hdr.msg_namelen = sizeof(struct sockaddr_in6);
+            hdr.msg_controllen = gro_ ? CONTROL_WORDS * sizeof(uint64_t) : 0;
+            hdr.msg_flags = 0;
+        }
+        int n = recvmmsg(fd_, &rx_msgs_[0], batch_size_, MSG_DONTWAIT, NULL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                OnError(errno, strerror(errno));
+            }
+            break;
+        }
+        Deliver(n);
+        if ((uint32_t)n < batch_size_) {
+            break;      // the receive queue is empty
+        }
+    }
+    if (PendingCount() > 0) {
+        Flush();
+    }
+}
+
+/// A coalesced receive (UDP_GRO) carries its segment size, it is split into
+/// the datagrams it was made of
+size_t UdpSocket::Deliver(size_t count)
+{
+    rx_dgrams_.clear();
+    for (size_t i = 0; i < count; i++) {
+        struct msghdr& hdr = rx_msgs_[i].msg_hdr;
+        const char* data = (const char*)rx_iovs_[i].iov_base;
+        uint32_t len = std::min<uint32_t>(rx_msgs_[i].msg_len, rx_iovs_[i].iov_len);
+        uint32_t segment = len;
+        if (gro_) {
+            for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                    int gso_size = 0;
+                    memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+                    if (gso_size > 0) segment = gso_size;
+                }
+            }
+        }
+        uint32_t offset = 0;
+        do {
+            Datagram dgram;
+            dgram.data = data + offset;
+            dgram.size = std::min(segment, len - offset);
+            dgram.peer = rx_peers_[i];
+            rx_dgrams_.push_back(dgram);
+            offset += dgram.size;
+        } while (offset < len);
+    }
+    rx_count_ += rx_dgrams_.size();
+    if (udp_evt_cbs_ && udp_evt_cbs_->on_datagrams_cb) {
+        udp_evt_cbs_->on_datagrams_cb(this, rx_dgrams_.data(), rx_dgrams_.size());
+    }
+    return rx_dgrams_.size();
+}
+
+void UdpSocket::PrepareRx()
+{
+    size_t buffer_size = gro_ ? GRO_BUFFER_SIZE : max_datagram_size_;
+    rx_buffer_.resize(batch_size_ * buffer_size);
+    rx_msgs_.resize(batch_size_);
+    rx_iovs_.resize(batch_size_);
+    rx_peers_.resize(batch_size_);
+    rx_control_.resize(batch_size_ * CONTROL_WORDS);
+    rx_dgrams_.reserve(batch_size_);
+    for (uint32_t i = 0; i < batch_size_; i++) {
+        rx_iovs_[i].iov_base = &rx_buffer_[i * buffer_size];
+        rx_iovs_[i].iov_len = buffer_size;
+        memset(&rx_msgs_[i], 0, sizeof(rx_msgs_[i]));
+        struct msghdr& hdr = rx_msgs_[i].msg_hdr;
+        hdr.msg_name = &rx_peers_[i].sa;
+        hdr.msg_iov = &rx_iovs_[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = &rx_control_[i * CONTROL_WORDS];
+    }
+}
+
+/// Fills one message from the queue entry first on. With GSO, the datagrams
+/// following a full sized one to the same peer join it as segments, the last
+/// segment may be shorter. Returns the number of entries taken.
+int UdpSocket::PackTx(size_t first, struct mmsghdr& msg, struct iovec* iovs, char* control)
+{
+    const TxEntry& head = tx_queue_[first];
+    memset(&msg, 0, sizeof(msg));
+    iovs[0].iov_base = &tx_buffer_[head.offset];
+    iovs[0].iov_len = head.size;
+    int count = 1;
+    if (gso_size_ > 0 && head.size == gso_size_) {
+        size_t total = head.size;
+        while (count < UDP_MAX_SEGMENTS && first + count < tx_queue_.size()) {
+            const TxEntry& entry = tx_queue_[first + count];
+            if (entry.size > gso_size_ || total + entry.size > UDP_MAX_PAYLOAD || !SamePeer(entry.peer, head.peer)) {
+                break;
+            }
+            iovs[count].iov_base = &tx_buffer_[entry.offset];
+            iovs[count].iov_len = entry.size;
+            total += entry.size;
+            count++;
+            if (entry.size < gso_size_) {
+                break;
+            }
+        }
+    }
+
+    struct msghdr& hdr = msg.msg_hdr;
+    hdr.msg_iov = iovs;
+    hdr.msg_iovlen = count;
+    if (head.peer.Family() != AF_UNSPEC) {
+        hdr.msg_name = (void*)&head.peer.sa;
+        hdr.msg_namelen = head.peer.Length();
+    }
+    if (count > 1) {
+        hdr.msg_control = control;
+        hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        memcpy(CMSG_DATA(cmsg), &gso_size_, sizeof(uint16_t));
+    }
+    return count;
+}
+
+}  // namespace evt_loop
@@ -1,4 +1,5 @@
 #include "utils.h"
+#include <stddef.h>
 
 namespace evt_loop {
 
@@ -71,7 +72,124 @@ void SocketAddrToIPAddress(const struct sockaddr_in& sock_addr, IPAddress& ip_ad
   char buffer[INET_ADDRSTRLEN] = {0};
   inet_ntop(sock_addr.sin_family, (void*)&sock_addr.sin_addr, buffer, sizeof(buffer));
   ip_addr.ip_.assign(buffer);
-  ip_addr.port_ = sock_addr.sin_port;
+  ip_addr.port_ = ntohs(sock_addr.sin_port);
+}
+
+void SocketAddrToIPAddress(const struct sockaddr* sock_addr, socklen_t len, IPAddress& ip_addr)
+{
+  char buffer[INET6_ADDRSTRLEN] = {0};
+  switch (sock_addr->sa_family) {
+    case AF_INET: {
+      SocketAddrToIPAddress(*(const struct sockaddr_in*)sock_addr, ip_addr);
+      break;
+    }
+    case AF_INET6: {
+      const struct sockaddr_in6* v6 = (const struct sockaddr_in6*)sock_addr;
+      inet_ntop(AF_INET6, &v6->sin6_addr, buffer, sizeof(buffer));
+      ip_addr.ip_.assign(buffer);
+      ip_addr.port_ = ntohs(v6->sin6_port);
+      break;
+    }
+    case AF_UNIX: {
+      /// An unnamed socket has no path at all, an abstract name starts with a
+      /// NUL byte and its length is the rest of the address
+      const struct sockaddr_un* un = (const struct sockaddr_un*)sock_addr;
+      size_t path_len = len > offsetof(struct sockaddr_un, sun_path) ? len - offsetof(struct sockaddr_un, sun_path) : 0;
+      ip_addr.ip_ = UNIX_ADDR_PREFIX;
+      if (path_len > 0 && un->sun_path[0] == '\0') {
+        ip_addr.ip_.append(1, '@').append(un->sun_path + 1, path_len - 1);
+      } else if (path_len > 0) {
+        ip_addr.ip_.append(un->sun_path, strnlen(un->sun_path, path_len));
+      }
+      ip_addr.port_ = 0;
+      break;
+    }
+    default:
+      ip_addr = IPAddress();
+      break;
+  }
+}
+
+bool IPAddressToSocketAddr(const IPAddress& ip_addr, struct sockaddr_storage& sock_addr, socklen_t& len)
+{
+  memset(&sock_addr, 0, sizeof(sock_addr));
+  const string& host = ip_addr.ip_;
+  if (host.compare(0, strlen(UNIX_ADDR_PREFIX), UNIX_ADDR_PREFIX) == 0) {
+    struct sockaddr_un* un = (struct sockaddr_un*)&sock_addr;
+    string path = host.substr(strlen(UNIX_ADDR_PREFIX));
+    if (path.empty() || path.size() >= sizeof(un->sun_path)) {
+      return false;
+    }
+    un->sun_family = AF_UNIX;
+    memcpy(un->sun_path, path.data(), path.size());
+    if (path[0] == '@') {
+      un->sun_path[0] = '\0';  // abstract, the name is not NUL terminated
+      len = offsetof(struct sockaddr_un, sun_path) + path.size();
+    } else {
+      len = offsetof(struct sockaddr_un, sun_path) + path.size() + 1;
+    }
+    return true;
+  }
+
+  string ip = host;
+  if (ip.size() > 2 && ip[0] == '[' && ip[ip.size() - 1] == ']') {
+    ip = ip.substr(1, ip.size() - 2);
+  }
+  struct sockaddr_in6* v6 = (struct sockaddr_in6*)&sock_addr;
+  if (inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1) {
+    v6->sin6_family = AF_INET6;
+    v6->sin6_port = htons(ip_addr.port_);
+    len = sizeof(*v6);
+    return true;
+  }
+  struct sockaddr_in* v4 = (struct sockaddr_in*)&sock_addr;
+  if (inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1) {
+    v4->sin_family = AF_INET;
+    v4->sin_port = htons(ip_addr.port_);
+    len = sizeof(*v4);
+    return true;
+  }
+  return false;
+}
+
+SockAddr::SockAddr(const struct sockaddr* addr, socklen_t len)
+{
+  memset(&v6, 0, sizeof(v6));
+  if (addr == NULL || len == 0) {
+    return;
+  }
+  if (addr->sa_family == AF_UNIX) {
+    sa.sa_family = AF_UNIX;
+  } else {
+    memcpy(&v6, addr, len < sizeof(v6) ? len : sizeof(v6));
+  }
+}
+
+socklen_t SockAddr::Length() const
+{
+  switch (Family()) {
+    case AF_INET6: return sizeof(v6);
+    case AF_INET:  return sizeof(v4);
+    default:       return sizeof(sa_family_t);
+  }
+}
+
+uint16_t SockAddr::Port() const
+{
+  switch (Family()) {
+    case AF_INET6: return ntohs(v6.sin6_port);
+    case AF_INET:  return ntohs(v4.sin_port);
+    default:       return 0;
+  }
+}
+
+IPAddress SockAddr::ToIPAddress() const
+{
+  IPAddress ip_addr;
+  if (Family() != AF_UNSPEC) {
+    SocketAddrToIPAddress(&sa, Length(), ip_addr);
+  }
+  return ip_addr;
 }
 
 }  // namespace evt_loop